@@ -219,6 +219,61 @@ local macro "nonempty_list" : tactic =>
 /-- Helper method for implementing "deterministic" timeouts. It is the number of "small" memory allocations performed by the current execution thread. -/
 @[extern "lean_io_get_num_heartbeats"] opaque getNumHeartbeats : BaseIO Nat
 
+/--
+Counters of the task manager, see `IO.getTaskStats`. Counts are accumulated since the task manager was
+started; a full per-task schedule can be recorded by setting the environment variable `LEAN_TASK_TRACE`
+to a file name, which receives a Chrome trace event (Perfetto) JSON file when the process exits. -/
+structure TaskStats where
+  /-- Number of standard worker threads. -/
+  numWorkers : Nat
+  /-- Number of standard worker threads not currently executing a task. -/
+  numIdleWorkers : Nat
+  /-- Number of threads running `Task.Priority.dedicated` tasks. -/
+  numDedicatedWorkers : Nat
+  /-- Number of tasks currently waiting in a queue. -/
+  queueDepth : Nat
+  /-- Maximal number of tasks that were waiting in a queue at the same time. -/
+  maxQueueDepth : Nat
+  /-- Number of tasks put into a queue. -/
+  numEnqueued : Nat
+  /-- Number of task executions. -/
+  numExecuted : Nat
+  /-- Number of tasks a worker took from the queue of another worker. -/
+  numSteals : Nat
+  /-- Number of `Task.get`/`IO.wait` calls that had to block. -/
+  numBlockingWaits : Nat
+  deriving Inhabited, Repr
+
+/-- Return the current counters of the task manager. All counters are zero if there is no task manager. -/
+@[extern "lean_io_get_task_stats"] opaque getTaskStats : BaseIO TaskStats
+
+/--
+Counters of the runtime functions that mark object graphs as shared between threads (e.g. when an object is
+captured by a task) or as persistent (e.g. when an object is stored in a global), see `IO.getMarkStats`.
+Marking stops at objects that are already shared or persistent, so the number of marked objects is the number of
+headers that were actually changed. -/
+structure MarkStats where
+  /-- Number of calls that marked objects as shared between threads. -/
+  numMtCalls : Nat
+  /-- Number of objects marked as shared between threads. -/
+  numMtMarked : Nat
+  /-- Maximal number of objects marked as shared between threads by a single call. -/
+  maxMtMarked : Nat
+  /-- Number of calls that marked objects as shared between threads using multiple threads. -/
+  numMtParallel : Nat
+  /-- Number of calls that marked objects as persistent. -/
+  numPersistentCalls : Nat
+  /-- Number of objects marked as persistent. -/
+  numPersistentMarked : Nat
+  /-- Maximal number of objects marked as persistent by a single call. -/
+  maxPersistentMarked : Nat
+  /-- Number of calls that marked objects as persistent using multiple threads. -/
+  numPersistentParallel : Nat
+  deriving Inhabited, Repr
+
+/-- Return the marking counters accumulated since the start of the process. -/
+@[extern "lean_io_get_mark_stats"] opaque getMarkStats : BaseIO MarkStats
+
 inductive FS.Mode where
   | read | write | readWrite | append
 
@@ -272,15 +272,59 @@ def Exception.isMaxHeartbeat (ex : Exception) : Bool :=
 def mkArrow (d b : Expr) : CoreM Expr :=
   return Lean.mkForall (← mkFreshUserName `x) BinderInfo.default d b
 
+register_builtin_option kernel.asyncTheorems : Bool := {
+  defValue := false
+  descr    := "type check the values of theorems in the background, errors are reported at the end of the file. Only supported by the command line frontend, ignored elsewhere, e.g. in the language server"
+}
+
+/-- Type check of the value of a theorem running in the background, see `kernel.asyncTheorems`. -/
+structure PendingKernelCheck where
+  declName : Name
+  fileName : String
+  pos      : Position
+  check    : Task (Except KernelException Unit)
+
+builtin_initialize pendingKernelChecksExt : EnvExtension (Array PendingKernelCheck) ←
+  registerEnvExtension (pure #[])
+
+/-- Whether the frontend processing the environment waits for background checks, see `Environment.waitKernelChecks`. -/
+builtin_initialize asyncKernelChecksExt : EnvExtension Bool ←
+  registerEnvExtension (pure false)
+
+/--
+  Allow `kernel.asyncTheorems` in `env`. The frontend must call `Environment.waitKernelChecks` on the final environment
+  and report the failed checks. -/
+def Environment.enableAsyncKernelChecks (env : Environment) : Environment :=
+  asyncKernelChecksExt.setState env true
+
 def addDecl (decl : Declaration) : CoreM Unit := do
   profileitM Exception "type checking" (← getOptions) do
     withTraceNode `Kernel (fun _ => return m!"typechecking declaration") do
       if !(← MonadLog.hasErrors) && decl.hasSorry then
         logWarning "declaration uses 'sorry'"
+      if let .thmDecl val := decl then
+        if kernel.asyncTheorems.get (← getOptions) && asyncKernelChecksExt.getState (← getEnv) then
+          match (← getEnv).addDeclAsync decl with
+          | Except.ok (env, check) =>
+            let pending := { declName := val.name, fileName := (← getFileName), pos := (← getRefPosition), check }
+            setEnv <| pendingKernelChecksExt.modifyState env (·.push pending)
+          | Except.error ex => throwKernelException ex
+          return
       match (← getEnv).addDecl decl with
       | Except.ok    env => setEnv env
       | Except.error ex  => throwKernelException ex
 
+/--
+  Wait for the theorems added to `env` with `kernel.asyncTheorems` to be checked, and return an error message for each
+  failed check. -/
+def Environment.waitKernelChecks (env : Environment) (opts : Options) : BaseIO MessageLog :=
+  (pendingKernelChecksExt.getState env).foldlM (init := {}) fun log pending => do
+    match (← IO.wait pending.check) with
+    | .ok ()    => return log
+    | .error ex =>
+      let data := m!"kernel failed to check theorem '{pending.declName}':{indentD (ex.toMessageData opts)}"
+      return log.add { fileName := pending.fileName, pos := pending.pos, data }
+
 private def supportedRecursors :=
   #[``Empty.rec, ``False.rec, ``Eq.ndrec, ``Eq.rec, ``Eq.recOn, ``Eq.casesOn, ``False.casesOn, ``Empty.casesOn, ``And.rec, ``And.casesOn]
 
@@ -103,7 +103,8 @@ def runFrontend
   let inputCtx := Parser.mkInputContext input fileName
   let (header, parserState, messages) ← Parser.parseHeader inputCtx
   let (env, messages) ← processHeader header opts messages inputCtx trustLevel
-  let env := env.setMainModule mainModuleName
+  -- failed background checks are reported below
+  let env := env.setMainModule mainModuleName |>.enableAsyncKernelChecks
   let mut commandState := Command.mkState env messages opts
 
   if ileanFileName?.isSome then
@@ -111,6 +112,9 @@ def runFrontend
     commandState := { commandState with infoState.enabled := true }
 
   let s ← IO.processCommands inputCtx parserState commandState
+  -- report theorems that failed to type check in the background before the module can be written
+  let kernelMessages ← s.commandState.env.waitKernelChecks opts
+  let s := { s with commandState.messages := s.commandState.messages ++ kernelMessages }
   for msg in s.commandState.messages.toList do
     IO.print (← msg.toString (includeEndPos := getPrintMessageEndPos opts))
 
@@ -44,6 +44,10 @@ def CompactedRegion := USize
 @[extern "lean_compacted_region_is_memory_mapped"]
 opaque CompactedRegion.isMemoryMapped : CompactedRegion → Bool
 
+/-- Size of the compacted region in bytes. -/
+@[extern "lean_compacted_region_size"]
+opaque CompactedRegion.size : CompactedRegion → USize
+
 /-- Free a compacted region and its contents. No live references to the contents may exist at the time of invocation. -/
 @[extern "lean_compacted_region_free"]
 unsafe opaque CompactedRegion.free : CompactedRegion → IO Unit
@@ -74,6 +78,17 @@ structure ModuleData where
   entries         : Array (Name × Array EnvExtensionEntry)
   deriving Inhabited
 
+/--
+Imported constants that are looked up in the module data on first access instead of being added to
+`Environment.constants` and `Environment.const2ModIdx` by `importModules`, see `importLazy`.
+-/
+structure LazyConstants where
+  /--
+  Module declaring each imported constant and its position in `ModuleData.constants`, or no position for auxiliary
+  declarations of the code generator. It is built in the background by `importModules`, see `mkLazyConstIndex`. -/
+  index : Task (HashMap Name (ModuleIdx × Option Nat))
+  deriving Inhabited
+
 /-- Environment fields that are not used often. -/
 structure EnvironmentHeader where
   /--
@@ -92,12 +107,16 @@ structure EnvironmentHeader where
   mainModule   : Name         := default
   /-- Direct imports -/
   imports      : Array Import := #[]
-  /-- Compacted regions for all imported modules. Objects in compacted memory regions do no require any memory management. -/
+  /--
+  Compacted regions for all imported modules, and for the import snapshot if one was used (see `importSnapshotDir`).
+  Objects in compacted memory regions do no require any memory management. -/
   regions      : Array CompactedRegion := #[]
   /-- Name of all imported modules (directly and indirectly). -/
   moduleNames  : Array Name   := #[]
   /-- Module data for all imported modules. -/
   moduleData   : Array ModuleData := #[]
+  /-- Imported constants that have not been added to the environment yet, if the modules were imported lazily. -/
+  lazyConsts   : Option LazyConstants := none
   deriving Nonempty
 
 /--
@@ -161,13 +180,28 @@ def addExtraName (env : Environment) (name : Name) : Environment :=
   else
     { env with extraConstNames := env.extraConstNames.insert name }
 
+/--
+Find the module declaring `n` among `mods`, and the constant if it is not an auxiliary declaration of the code
+generator. `mods` must be the modules `lazy` has been built from.
+-/
+def LazyConstants.find? (lazy : LazyConstants) (mods : Array ModuleData) (n : Name) : Option (ModuleIdx × Option ConstantInfo) :=
+  lazy.index.get.find? n |>.map fun (modIdx, idx?) =>
+    (modIdx, idx?.map fun idx => mods[(modIdx : Nat)]!.constants[idx]!)
+
+private def findLazy? (env : Environment) (n : Name) : Option (ModuleIdx × Option ConstantInfo) :=
+  match env.header.lazyConsts with
+  | some lazy => lazy.find? env.header.moduleData n
+  | none      => none
+
 @[export lean_environment_find]
 def find? (env : Environment) (n : Name) : Option ConstantInfo :=
   /- It is safe to use `find'` because we never overwrite imported declarations. -/
-  env.constants.find?' n
+  match env.constants.find?' n with
+  | some c => some c
+  | none   => env.findLazy? n |>.bind (·.2)
 
 def contains (env : Environment) (n : Name) : Bool :=
-  env.constants.contains n
+  env.constants.contains n || (env.findLazy? n |>.bind (·.2)).isSome
 
 def imports (env : Environment) : Array Import :=
   env.header.imports
@@ -196,7 +230,9 @@ private def getTrustLevel (env : Environment) : UInt32 :=
   env.header.trustLevel
 
 def getModuleIdxFor? (env : Environment) (declName : Name) : Option ModuleIdx :=
-  env.const2ModIdx.find? declName
+  match env.const2ModIdx.find? declName with
+  | some modIdx => some modIdx
+  | none        => env.findLazy? declName |>.map (·.1)
 
 def isConstructor (env : Environment) (declName : Name) : Bool :=
   match env.find? declName with
@@ -232,6 +268,13 @@ namespace Environment
 @[extern "lean_add_decl"]
 opaque addDecl (env : Environment) (decl : @& Declaration) : Except KernelException Environment
 
+/--
+  Same as `addDecl`, but the value of a theorem is type checked in a separate task, and the theorem is added as soon as
+  its type has been checked. The task returns the result of checking the value. Other declarations are checked
+  synchronously, and the task is already finished. -/
+@[extern "lean_add_decl_async"]
+opaque addDeclAsync (env : Environment) (decl : @& Declaration) : Except KernelException (Environment × Task (Except KernelException Unit))
+
 end Environment
 
 namespace ConstantInfo
@@ -609,11 +652,35 @@ def contains [Inhabited α] (ext : MapDeclarationExtension α) (env : Environmen
 
 end MapDeclarationExtension
 
+/--
+  `importsHash` is stored in the header of the .olean file, see `OleanHeader`. -/
 @[extern "lean_save_module_data"]
-opaque saveModuleData (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) : IO Unit
+opaque saveModuleData (fname : @& System.FilePath) (mod : @& Name) (data : @& ModuleData) (importsHash : UInt64 := 0) : IO Unit
 @[extern "lean_read_module_data"]
 opaque readModuleData (fname : @& System.FilePath) : IO (ModuleData × CompactedRegion)
 
+/-- Header of an .olean file. Files in the format written by stage0 have no header, see `readOleanHeader`. -/
+structure OleanHeader where
+  /-- Git hash of the Lean version that wrote the file, `readModuleData` rejects files of other versions. -/
+  githash     : String
+  /-- Hash of the module data stored in the file. -/
+  contentHash : UInt64
+  /-- Hash of the headers of the .olean files of the module's imports, see `writeModule`. -/
+  importsHash : UInt64
+  deriving Inhabited, Repr
+
+/--
+  Read the header of the .olean file `fname` without reading the module data. Return `none` if the file is in the
+  format written by stage0, which has neither a version nor hashes. -/
+@[extern "lean_read_olean_header"]
+opaque readOleanHeader (fname : @& System.FilePath) : IO (Option OleanHeader)
+/--
+  Write the objects of `data` to the .olean dictionary `fname`. While the environment variable `LEAN_OLEAN_DICTIONARY`
+  points to a dictionary, `saveModuleData` references objects of the dictionary instead of copying them, and the
+  resulting files can only be read with the same dictionary. -/
+@[extern "lean_save_olean_dictionary"]
+opaque saveOleanDictionary (fname : @& System.FilePath) (data : @& Array ModuleData) : IO Unit
+
 /--
   Free compacted regions of imports. No live references to imported objects may exist at the time of invocation; in
   particular, `env` should be the last reference to any `Environment` derived from these imports. -/
@@ -649,9 +716,27 @@ def mkModuleData (env : Environment) : IO ModuleData := do
     constNames, constants, entries
   }
 
+/--
+  Hash of the headers of the .olean files of `imports`. Since each header contains the imports hash of its own module,
+  the result changes whenever any .olean file of the import closure changes. Return `0`, which stands for an unknown
+  hash, if any of the files has no header. -/
+def mkImportsHash (imports : Array Import) : IO UInt64 := do
+  let mut h := 7
+  for i in imports do
+    let some header ← readOleanHeader (← findOLean i.module)
+      | return 0
+    if header.importsHash == 0 then
+      return 0
+    h := mixHash h (mixHash (hash i.module) (mixHash header.contentHash header.importsHash))
+  return h
+
 @[export lean_write_module]
 def writeModule (env : Environment) (fname : System.FilePath) : IO Unit := do
-  saveModuleData fname env.mainModule (← mkModuleData env)
+  saveModuleData fname env.mainModule (← mkModuleData env) (← mkImportsHash env.header.imports)
+
+/-- Write the data of all modules imported by `env` to the .olean dictionary `fname`, see `saveOleanDictionary`. -/
+def writeOleanDictionary (env : Environment) (fname : System.FilePath) : IO Unit :=
+  saveOleanDictionary fname env.header.moduleData
 
 /--
 Construct a mapping from persistent extension name to entension index at the array of persistent extensions.
@@ -695,10 +780,20 @@ private def setImportedEntries (env : Environment) (mods : Array ModuleData) (st
 /-- "Forward declaration" for retrieving the number of builtin attributes. -/
 @[extern 1 "lean_get_num_attributes"] opaque getNumBuiltinAttributes : IO Nat
 
-private partial def finalizePersistentExtensions (env : Environment) (mods : Array ModuleData) (opts : Options) : IO Environment := do
-  loop 0 env
+/-- Statistics about a persistent environment extension during an import, see `ImportStats`. -/
+structure ExtensionImportStats where
+  name             : Name
+  /-- Number of imported entries of the extension. -/
+  numEntries       : Nat
+  /-- Time spent in `addImportedFn` of the extension, in nanoseconds. -/
+  addImportedNanos : Nat
+  deriving Inhabited
+
+private partial def finalizePersistentExtensions (env : Environment) (mods : Array ModuleData) (opts : Options) :
+    IO (Environment × Array ExtensionImportStats) := do
+  loop 0 env #[]
 where
-  loop (i : Nat) (env : Environment) : IO Environment := do
+  loop (i : Nat) (env : Environment) (stats : Array ExtensionImportStats) : IO (Environment × Array ExtensionImportStats) := do
     -- Recall that the size of the array stored `persistentEnvExtensionRef` may increase when we import user-defined environment extensions.
     let pExtDescrs ← persistentEnvExtensionsRef.get
     if i < pExtDescrs.size then
@@ -706,7 +801,13 @@ where
       let s := extDescr.toEnvExtension.getState env
       let prevSize := (← persistentEnvExtensionsRef.get).size
       let prevAttrSize ← getNumBuiltinAttributes
+      let start ← IO.monoNanosNow
       let newState ← extDescr.addImportedFn s.importedEntries { env := env, opts := opts }
+      let stats := stats.push {
+        name             := extDescr.name
+        numEntries       := s.importedEntries.foldl (fun sum es => sum + es.size) 0
+        addImportedNanos := (← IO.monoNanosNow) - start
+      }
       let mut env := extDescr.toEnvExtension.setState env { s with state := newState }
       env ← ensureExtensionsArraySize env
       if (← persistentEnvExtensionsRef.get).size > prevSize || (← getNumBuiltinAttributes) > prevAttrSize then
@@ -716,46 +817,355 @@ where
         env ← setImportedEntries env mods prevSize
         -- See comment at `updateEnvAttributesRef`
         env ← updateEnvAttributes env
-      loop (i + 1) env
+      loop (i + 1) env stats
     else
-      return env
+      return (env, stats)
+
+/-- Statistics about an imported module, see `ImportStats`. -/
+structure ModuleImportStats where
+  module         : Name
+  /-- Time spent finding the .olean file of the module, in nanoseconds. -/
+  openNanos      : Nat
+  /-- Time spent reading the .olean file, including relocating it if it could not be `mmap`ed, in nanoseconds. -/
+  readNanos      : Nat
+  isMemoryMapped : Bool
+  /-- Size of the compacted region of the module in bytes. -/
+  byteSize       : Nat
+  deriving Inhabited
+
+/--
+Timings and counters of the phases of `importModules`, all times are in nanoseconds. With `importParallel`, the reads
+of the modules overlap, so their sum can exceed `readNanos`. -/
+structure ImportStats where
+  modules                 : Array ModuleImportStats := #[]
+  /-- Time until all modules have been read. -/
+  readNanos               : Nat := 0
+  /-- Time spent building `constantMap` and `const2ModIdx`, or reading them from a snapshot. -/
+  constantTablesNanos     : Nat := 0
+  setImportedEntriesNanos : Nat := 0
+  /-- Time spent in `finalizePersistentExtensions`, see `extensions` for the time of each extension. -/
+  finalizeNanos           : Nat := 0
+  extensions              : Array ExtensionImportStats := #[]
+  totalNanos              : Nat := 0
+  deriving Inhabited
+
+/-- Number of bytes of the imported modules that could not be `mmap`ed, and have been relocated instead. -/
+def ImportStats.relocatedBytes (s : ImportStats) : Nat :=
+  s.modules.foldl (fun sum m => if m.isMemoryMapped then sum else sum + m.byteSize) 0
+
+/-- Statistics of the most recent call to `importModules` in this process. -/
+builtin_initialize importStatsRef : IO.Ref ImportStats ← IO.mkRef {}
 
 structure ImportState where
   moduleNameSet : NameHashSet := {}
   moduleNames   : Array Name := #[]
   moduleData    : Array ModuleData := #[]
   regions       : Array CompactedRegion := #[]
+  moduleStats   : Array ModuleImportStats := #[]
 
 def throwAlreadyImported (s : ImportState) (const2ModIdx : HashMap Name ModuleIdx) (modIdx : Nat) (cname : Name) : IO α := do
   let modName := s.moduleNames[modIdx]!
   let constModName := s.moduleNames[const2ModIdx[cname].get!.toNat]!
   throw <| IO.userError s!"import {modName} failed, environment already contains '{cname}' from {constModName}"
 
+register_builtin_option importParallel : Bool := {
+  defValue := false
+  descr    := "read imported modules concurrently, and build the constant tables of the imported environment in parallel. The reads block tasks of the shared thread pool"
+}
+
+register_builtin_option importLazy : Bool := {
+  defValue := false
+  descr    := "do not add imported constants to the environment, look them up in the imported modules on first access instead. Duplicate declarations in imported modules are not reported, and iterating over `Environment.constants` only visits the constants that have been declared after the import"
+}
+
+/-- An imported module that has been read by `readModule`. -/
+private structure ModuleRead where
+  data   : ModuleData
+  region : CompactedRegion
+  stats  : ModuleImportStats
+
+private def readModule (mod : Name) : IO ModuleRead := do
+  let start ← IO.monoNanosNow
+  let mFile ← findOLean mod
+  unless (← mFile.pathExists) do
+    throw <| IO.userError s!"object file '{mFile}' of module {mod} does not exist"
+  let opened ← IO.monoNanosNow
+  let (data, region) ← readModuleData mFile
+  return { data, region, stats := {
+    module         := mod
+    openNanos      := opened - start
+    readNanos      := (← IO.monoNanosNow) - opened
+    isMemoryMapped := region.isMemoryMapped
+    byteSize       := region.size.toNat
+  } }
+
+/-- Reads of imported modules that have been started by `prefetchImports`. -/
+private abbrev ModuleReads := IO.Ref (HashMap Name (Task (Except IO.Error ModuleRead)))
+
+/--
+  Start reading the modules in `imports` that are not being read yet, each in its own task. As soon as a module has
+  been read, its own imports are prefetched, so the whole import DAG is read concurrently. -/
+private partial def prefetchImports (reads : ModuleReads) (imports : Array Import) : BaseIO Unit := do
+  for i in imports do
+    unless i.runtimeOnly || (← reads.get).contains i.module do
+      let promise ← IO.Promise.new
+      -- another task may have claimed the module in the meantime
+      let isNew ← reads.modifyGet fun m =>
+        if m.contains i.module then (false, m) else (true, m.insert i.module promise.result)
+      if isNew then
+        discard <| BaseIO.asTask do
+          let r ← (readModule i.module).toBaseIO
+          if let .ok read := r then
+            prefetchImports reads read.data.imports
+          promise.resolve r
+      else
+        -- nobody waits on the promise that lost the race, but every promise must be resolved
+        promise.resolve (.error default)
+
+/--
+  Wait for all reads started by `prefetchImports`, including the ones started while waiting, and return the regions of
+  the modules that have been read. The reads are removed from `reads`, so the regions can be freed once the caller
+  drops its own references to the imported modules. -/
+private partial def takePrefetchedRegions (reads : ModuleReads) : BaseIO (Array CompactedRegion) := do
+  let m ← reads.get
+  for (_, t) in m.toList do
+    discard <| IO.wait t
+  if (← reads.get).size != m.size then
+    takePrefetchedRegions reads
+  else
+    reads.set {}
+    return m.fold (init := #[]) fun regions _ t =>
+      match t.get with
+      | .ok read => regions.push read.region
+      | .error _ => regions
+
+private unsafe def freeImportedRegionsImp (regions : Array CompactedRegion) : IO Unit :=
+  regions.forM CompactedRegion.free
+
+/-- Free regions read by `importModules` that are not used by the imported environment, see `CompactedRegion.free`. -/
+@[implemented_by freeImportedRegionsImp]
+private opaque freeImportedRegions (regions : Array CompactedRegion) : IO Unit
+
+/-- Build `constantMap` and `const2ModIdx` of the imported environment, and check for duplicate declarations. -/
+private def mkImportedConstantTables (s : ImportState) (numConsts : Nat) :
+    IO (HashMap Name ConstantInfo × HashMap Name ModuleIdx) := do
+  let mut modIdx : Nat := 0
+  let mut const2ModIdx : HashMap Name ModuleIdx := mkHashMap (capacity := numConsts)
+  let mut constantMap : HashMap Name ConstantInfo := mkHashMap (capacity := numConsts)
+  for mod in s.moduleData do
+    for cname in mod.constNames, cinfo in mod.constants do
+      match constantMap.insert' cname cinfo with
+      | (constantMap', replaced) =>
+        constantMap := constantMap'
+        if replaced then
+          throwAlreadyImported s const2ModIdx modIdx cname
+      const2ModIdx := const2ModIdx.insert cname modIdx
+    for cname in mod.extraConstNames do
+      const2ModIdx := const2ModIdx.insert cname modIdx
+    modIdx := modIdx + 1
+  return (constantMap, const2ModIdx)
+
+/-- Same `constantMap` as `mkImportedConstantTables`, or `none` if there are duplicate declarations. -/
+private def mkImportedConstantMap? (mods : Array ModuleData) (numConsts : Nat) : Option (HashMap Name ConstantInfo) := do
+  let mut constantMap : HashMap Name ConstantInfo := mkHashMap (capacity := numConsts)
+  for mod in mods do
+    for cname in mod.constNames, cinfo in mod.constants do
+      let (constantMap', replaced) := constantMap.insert' cname cinfo
+      if replaced then
+        none
+      constantMap := constantMap'
+  return constantMap
+
+/-- Same `const2ModIdx` as `mkImportedConstantTables`. -/
+private def mkImportedConst2ModIdx (mods : Array ModuleData) (numConsts : Nat) : HashMap Name ModuleIdx := Id.run do
+  let mut const2ModIdx : HashMap Name ModuleIdx := mkHashMap (capacity := numConsts)
+  for h : modIdx in [:mods.size] do
+    have : modIdx < mods.size := h.upper
+    let mod := mods[modIdx]
+    for cname in mod.constNames do
+      const2ModIdx := const2ModIdx.insert cname modIdx
+    for cname in mod.extraConstNames do
+      const2ModIdx := const2ModIdx.insert cname modIdx
+  return const2ModIdx
+
+/-- `LazyConstants.index` of the modules `mods`. -/
+private def mkLazyConstIndex (mods : Array ModuleData) (numConsts : Nat) : HashMap Name (ModuleIdx × Option Nat) := Id.run do
+  let mut index : HashMap Name (ModuleIdx × Option Nat) := mkHashMap (capacity := numConsts)
+  for h : modIdx in [:mods.size] do
+    have : modIdx < mods.size := h.upper
+    let mod := mods[modIdx]
+    for h : idx in [:mod.constNames.size] do
+      have : idx < mod.constNames.size := h.upper
+      index := index.insert mod.constNames[idx] (modIdx, some idx)
+    for cname in mod.extraConstNames do
+      unless index.contains cname do
+        index := index.insert cname (modIdx, none)
+  return index
+
+register_builtin_option importSnapshotDir : String := {
+  defValue := ""
+  descr    := "directory in which the constant tables of imported environments are saved, and reused by later imports of the same modules. Snapshots are disabled if the option is empty"
+}
+
+/--
+Constant tables of the environment created by `importModules` for a list of imports, see `importSnapshotDir`.
+The fingerprints of the .olean files are used to detect snapshots of modules that have changed since. Constants are
+stored as their positions in the imported modules, so the snapshot does not duplicate the contents of the .olean files.
+-/
+structure ImportSnapshot where
+  moduleNames  : Array Name
+  fingerprints : Array UInt64
+  /-- Module and position in `ModuleData.constants` of each imported constant, the keys of `constantMap`. -/
+  constIdx     : HashMap Name (ModuleIdx × Nat)
+  const2ModIdx : HashMap Name ModuleIdx
+  deriving Inhabited
+
+@[extern "lean_save_module_data"]
+private opaque saveImportSnapshot (fname : @& System.FilePath) (key : @& Name) (data : @& ImportSnapshot) (importsHash : UInt64 := 0) : IO Unit
+@[extern "lean_read_module_data"]
+private opaque readImportSnapshot (fname : @& System.FilePath) : IO (ImportSnapshot × CompactedRegion)
+
+private def importSnapshotKey (imports : List Import) : UInt64 :=
+  imports.foldl (fun h i => mixHash h (mixHash (hash i.module) (hash i.runtimeOnly))) 11
+
+/--
+Content and imports hash of the .olean file of `mod`, see `OleanHeader`. Return `none` if the file has no header or a
+hash is unknown, then changes of the file or of its imports cannot be detected. -/
+private def oleanFingerprint? (mod : Name) : IO (Option UInt64) := do
+  let some header ← readOleanHeader (← findOLean mod)
+    | return none
+  if header.contentHash == 0 || header.importsHash == 0 then
+    return none
+  return some (mixHash header.contentHash header.importsHash)
+
+private unsafe def mapValsUnsafe {α β : Type} (m : HashMap Name α) (f : α → β) : HashMap Name β :=
+  ⟨{ size := m.val.size, buckets := ⟨m.val.buckets.val.map (·.mapVal f), lcProof⟩ }, lcProof⟩
+
+/-- Apply `f` to the values of `m`. The buckets of `m` are kept, so no key is hashed or compared again. -/
+@[implemented_by mapValsUnsafe]
+private def mapVals {α β : Type} (m : HashMap Name α) (f : α → β) : HashMap Name β :=
+  m.fold (init := {}) fun r k v => r.insert k (f v)
+
+/-- `ImportSnapshot.constIdx` of the modules `mods`. -/
+private def mkImportedConstIdx (mods : Array ModuleData) (numConsts : Nat) : HashMap Name (ModuleIdx × Nat) := Id.run do
+  let mut constIdx : HashMap Name (ModuleIdx × Nat) := mkHashMap (capacity := numConsts)
+  for h : modIdx in [:mods.size] do
+    have : modIdx < mods.size := h.upper
+    let mod := mods[modIdx]
+    for h : idx in [:mod.constNames.size] do
+      have : idx < mod.constNames.size := h.upper
+      constIdx := constIdx.insert mod.constNames[idx] (modIdx, idx)
+  return constIdx
+
+/-- Whether each position of `constIdx` is the position of a constant of the same name in `mods`. -/
+private def constIdxMatches (mods : Array ModuleData) (constIdx : HashMap Name (ModuleIdx × Nat)) : Bool :=
+  constIdx.fold (init := true) fun ok n (modIdx, idx) =>
+    ok && (mods[(modIdx : Nat)]?.bind (·.constNames[idx]?)) == some n
+
+/--
+Read the snapshot `fname` if it has been written for the modules of `s`, which have the given fingerprints. A stale
+snapshot is freed right away. -/
+private def readImportSnapshot? (fname : System.FilePath) (s : ImportState) (fingerprints : Array UInt64) :
+    IO (Option (ImportSnapshot × CompactedRegion)) := do
+  unless (← fname.pathExists) do
+    return none
+  let .ok (snapshot, region) ← (readImportSnapshot fname).toBaseIO
+    -- e.g. a snapshot written by an incompatible version, it is overwritten by the caller
+    | return none
+  -- also check the positions of the constants, which are looked up without bounds checks
+  if snapshot.moduleNames == s.moduleNames && snapshot.fingerprints == fingerprints &&
+      constIdxMatches s.moduleData snapshot.constIdx then
+    return some (snapshot, region)
+  -- no object of the snapshot is referenced anymore
+  freeImportedRegions #[region]
+  return none
+
+/--
+Reuse the constant tables saved in `dir` for `imports` if the imported .olean files have not changed. Otherwise, build
+them with `build` and save them for later imports. Also return the region of the snapshot if one was used, it must be
+freed together with the environment. -/
+private def mkImportedConstantTablesUsingSnapshot (dir : System.FilePath) (imports : List Import) (s : ImportState)
+    (build : IO (HashMap Name ConstantInfo × HashMap Name ModuleIdx)) :
+    IO ((HashMap Name ConstantInfo × HashMap Name ModuleIdx) × Option CompactedRegion) := do
+  let key := importSnapshotKey imports
+  let fname := dir / s!"imports-{key}.snapshot"
+  let fingerprints ← s.moduleNames.mapM oleanFingerprint?
+  let some fingerprints := fingerprints.mapM id
+    | return (← build, none)
+  if let some (snapshot, region) ← readImportSnapshot? fname s fingerprints then
+    let constantMap := mapVals snapshot.constIdx fun (modIdx, idx) => s.moduleData[(modIdx : Nat)]!.constants[idx]!
+    return ((constantMap, snapshot.const2ModIdx), some region)
+  let (constantMap, const2ModIdx) ← build
+  try
+    IO.FS.createDirAll dir
+    let constIdx := mkImportedConstIdx s.moduleData constantMap.size
+    saveImportSnapshot fname (.num `_importSnapshot key.toNat) { moduleNames := s.moduleNames, fingerprints, constIdx, const2ModIdx }
+  catch _ =>
+    -- snapshots are only an optimization
+    pure ()
+  return ((constantMap, const2ModIdx), none)
+
 @[export lean_import_modules]
 partial def importModules (imports : List Import) (opts : Options) (trustLevel : UInt32 := 0) : IO Environment := profileitIO "import" opts do
   for imp in imports do
     if imp.module matches .anonymous then
       throw <| IO.userError "import failed, trying to import module with anonymous name"
   withImporting do
-    let (_, s) ← importMods imports |>.run {}
+    let start ← IO.monoNanosNow
+    let parallel := importParallel.get opts
+    let reads? ← if parallel then
+      let reads ← IO.mkRef {}
+      prefetchImports reads imports.toArray
+      pure (some reads)
+    else
+      pure none
+    let sRef ← IO.mkRef {}
+    try
+      importMods reads? imports sRef
+    catch e =>
+      -- no environment has been created, so only `sRef` and `reads?` reference the modules that have been read
+      let mut regions := (← sRef.swap {}).regions
+      if let some reads := reads? then
+        for region in (← takePrefetchedRegions reads) do
+          unless regions.any (fun r => (r : USize) == region) do
+            regions := regions.push region
+      freeImportedRegions regions
+      throw e
+    let s ← sRef.get
+    let read ← IO.monoNanosNow
     let mut numConsts := 0
     for mod in s.moduleData do
       numConsts := numConsts + mod.constants.size + mod.extraConstNames.size
-    let mut modIdx : Nat := 0
-    let mut const2ModIdx : HashMap Name ModuleIdx := mkHashMap (capacity := numConsts)
-    let mut constantMap : HashMap Name ConstantInfo := mkHashMap (capacity := numConsts)
-    for mod in s.moduleData do
-      for cname in mod.constNames, cinfo in mod.constants do
-        match constantMap.insert' cname cinfo with
-        | (constantMap', replaced) =>
-          constantMap := constantMap'
-          if replaced then
-            throwAlreadyImported s const2ModIdx modIdx cname
-        const2ModIdx := const2ModIdx.insert cname modIdx
-      for cname in mod.extraConstNames do
-        const2ModIdx := const2ModIdx.insert cname modIdx
-      modIdx := modIdx + 1
+    let build : IO (HashMap Name ConstantInfo × HashMap Name ModuleIdx) := do
+      if parallel then
+        -- `const2ModIdx` does not depend on `constantMap`, build them concurrently
+        let const2ModIdx := Task.spawn fun _ => mkImportedConst2ModIdx s.moduleData numConsts
+        match mkImportedConstantMap? s.moduleData numConsts with
+        | some constantMap => pure (constantMap, const2ModIdx.get)
+        | none             => mkImportedConstantTables s numConsts -- reports the duplicate declaration
+      else
+        mkImportedConstantTables s numConsts
+    let lazy := importLazy.get opts
+    let snapshotDir := importSnapshotDir.get opts
+    let mut regions := s.regions
+    let mut tables : HashMap Name ConstantInfo × HashMap Name ModuleIdx := ({}, {})
+    if !lazy then
+      if snapshotDir.isEmpty then
+        tables ← build
+      else
+        let (tables', region?) ← mkImportedConstantTablesUsingSnapshot snapshotDir imports s build
+        tables := tables'
+        if let some region := region? then
+          regions := regions.push region
+    let (constantMap, const2ModIdx) := tables
+    let constantTables ← IO.monoNanosNow
     let constants : ConstMap := SMap.fromHashMap constantMap false
+    let lazyConsts : Option LazyConstants := if lazy then
+        let index := fun (_ : Unit) => mkLazyConstIndex s.moduleData numConsts
+        -- only the first lookup waits for the index
+        some { index := if parallel then Task.spawn index else .pure (index ()) }
+      else
+        none
     let exts ← mkInitialExtensionStates
     let env : Environment := {
       const2ModIdx    := const2ModIdx
@@ -766,33 +1176,47 @@ partial def importModules (imports : List Import) (opts : Options) (trustLevel :
         quotInit     := !imports.isEmpty -- We assume `core.lean` initializes quotient module
         trustLevel   := trustLevel
         imports      := imports.toArray
-        regions      := s.regions
+        regions      := regions
         moduleNames  := s.moduleNames
         moduleData   := s.moduleData
+        lazyConsts   := lazyConsts
       }
     }
     let env ← setImportedEntries env s.moduleData
-    let env ← finalizePersistentExtensions env s.moduleData opts
+    let importedEntries ← IO.monoNanosNow
+    let (env, extensions) ← finalizePersistentExtensions env s.moduleData opts
+    let finalized ← IO.monoNanosNow
+    importStatsRef.set {
+      modules                 := s.moduleStats
+      readNanos               := read - start
+      constantTablesNanos     := constantTables - read
+      setImportedEntriesNanos := importedEntries - constantTables
+      finalizeNanos           := finalized - importedEntries
+      totalNanos              := finalized - start
+      extensions
+    }
     pure env
 where
-  importMods : List Import → StateRefT ImportState IO Unit
+  importMods (reads? : Option ModuleReads) : List Import → StateRefT ImportState IO Unit
   | []    => pure ()
   | i::is => do
     if i.runtimeOnly || (← get).moduleNameSet.contains i.module then
-      importMods is
+      importMods reads? is
     else do
       modify fun s => { s with moduleNameSet := s.moduleNameSet.insert i.module }
-      let mFile ← findOLean i.module
-      unless (← mFile.pathExists) do
-        throw <| IO.userError s!"object file '{mFile}' of module {i.module} does not exist"
-      let (mod, region) ← readModuleData mFile
-      importMods mod.imports.toList
+      -- modules are still added in depth-first order, so the environment does not depend on `importParallel`
+      let read ← match (← reads?.mapM (·.get)).bind (·.find? i.module) with
+        | some read => do MonadExcept.ofExcept (← IO.wait read)
+        | none      => readModule i.module
+      -- record the region before importing the dependencies, so it is freed if they fail
+      modify fun s => { s with regions := s.regions.push read.region }
+      importMods reads? read.data.imports.toList
       modify fun s => { s with
-        moduleData  := s.moduleData.push mod
-        regions     := s.regions.push region
+        moduleData  := s.moduleData.push read.data
         moduleNames := s.moduleNames.push i.module
+        moduleStats := s.moduleStats.push read.stats
       }
-      importMods is
+      importMods reads? is
 
 /--
   Create environment object from imports and free compacted regions after calling `act`. No live references to the
@@ -851,7 +1275,7 @@ def add (env : Environment) (cinfo : ConstantInfo) : Environment :=
 def displayStats (env : Environment) : IO Unit := do
   let pExtDescrs ← persistentEnvExtensionsRef.get
   IO.println ("direct imports:                        " ++ toString env.header.imports);
-  IO.println ("number of imported modules:            " ++ toString env.header.regions.size);
+  IO.println ("number of imported modules:            " ++ toString env.header.moduleNames.size);
   IO.println ("number of memory-mapped modules:       " ++ toString (env.header.regions.filter (·.isMemoryMapped) |>.size));
   IO.println ("number of consts:                      " ++ toString env.constants.size);
   IO.println ("number of imported consts:             " ++ toString env.constants.stageSizes.1);
@@ -859,12 +1283,22 @@ def displayStats (env : Environment) : IO Unit := do
   IO.println ("number of buckets for imported consts: " ++ toString env.constants.numBuckets);
   IO.println ("trust level:                           " ++ toString env.header.trustLevel);
   IO.println ("number of extensions:                  " ++ toString env.extensions.size);
+  let importStats ← importStatsRef.get
+  let ms (ns : Nat) := toString (ns.toFloat / 1000000) ++ "ms"
+  IO.println ("import time:                           " ++ ms importStats.totalNanos);
+  IO.println ("  reading modules:                     " ++ ms importStats.readNanos);
+  IO.println ("  relocated bytes:                     " ++ toString importStats.relocatedBytes);
+  IO.println ("  constant tables:                     " ++ ms importStats.constantTablesNanos);
+  IO.println ("  setting imported entries:            " ++ ms importStats.setImportedEntriesNanos);
+  IO.println ("  finalizing extensions:               " ++ ms importStats.finalizeNanos);
   pExtDescrs.forM fun extDescr => do
     IO.println ("extension '" ++ toString extDescr.name ++ "'")
     let s := extDescr.toEnvExtension.getState env
     let fmt := extDescr.statsFn s.state
     unless fmt.isNil do IO.println ("  " ++ toString (Format.nest 2 (extDescr.statsFn s.state)))
     IO.println ("  number of imported entries: " ++ toString (s.importedEntries.foldl (fun sum es => sum + es.size) 0))
+    if let some stats := importStats.extensions.find? (·.name == extDescr.name) then
+      IO.println ("  addImportedFn time: " ++ ms stats.addImportedNanos)
 
 /--
   Evaluate the given declaration under the given environment to a value of the given type.
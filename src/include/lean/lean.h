@@ -212,7 +212,8 @@ typedef struct {
 } lean_task_imp;
 
 /* Object of type `Task _`. The lifetime of a `lean_task` object can be represented as a state machine with atomic
-   state transitions.
+   state transitions. Each transition happens under the lock of the wait slot the task is mapped to by
+   `task_manager::get_slot`.
 
    In the following, `condition` describes a predicate uniquely identifying a state.
 
@@ -224,28 +225,28 @@ typedef struct {
 
    states:
    * Queued
-     * condition: in task_manager::m_queues && m_imp != nullptr && !m_imp->m_deleted
+     * condition: in a task_manager queue && m_imp != nullptr && !m_imp->m_deleted
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: dequeued by worker thread            ==> Running     (`spawn_worker` lock)
+     * transition: dequeued by worker thread            ==> Running     (`run_task` lock)
    * Waiting
      * condition: reachable from task via `m_head_dep->m_next_dep->...` && !m_imp->m_deleted
      * invariant: m_imp != nullptr && m_value == nullptr
      * invariant: task dependency is Queued/Waiting/Running
        * It cannot become Deactivated because this task should be holding an owned reference to it
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: task dependency Finished ==> Queued (`handle_finished` under `spawn_worker` lock)
+     * transition: task dependency Finished ==> Queued (`handle_finished` lock)
    * Promised
      * condition: obtained as result from promise
      * invariant: m_imp != nullptr && m_value == nullptr
-     * transition: promise resolved ==> Finished (`resolve_core` under `spawn_worker` lock)
+     * transition: promise resolved ==> Finished (`resolve_core` lock)
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
    * Running
      * condition: m_imp != nullptr && m_imp->m_closure == nullptr
        * The worker takes ownership of the closure when running it
      * invariant: m_value == nullptr
      * transition: RC becomes 0 ==> Deactivated (`deactivate_task` lock)
-     * transition: finished execution                   ==> Finished    (`spawn_worker` lock)
+     * transition: finished execution                   ==> Finished    (`run_task` lock)
    * Deactivated
      * condition: m_imp != nullptr && m_imp->m_deleted
      * invariant: RC == 0
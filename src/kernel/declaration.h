@@ -106,6 +106,7 @@ public:
     expr const & get_type() const { return to_constant_val().get_type(); }
     expr const & get_value() const { return static_cast<expr const &>(cnstr_get_ref(*this, 1)); }
     reducibility_hints const & get_hints() const { return static_cast<reducibility_hints const &>(cnstr_get_ref(*this, 2)); }
+    names const & get_all() const { return static_cast<names const &>(cnstr_get_ref(*this, 3)); }
     definition_safety get_safety() const;
     bool is_unsafe() const { return get_safety() == definition_safety::unsafe; }
 };
@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include <limits>
 #include "runtime/sstream.h"
 #include "runtime/thread.h"
+#include "runtime/interrupt.h"
 #include "util/map_foreach.h"
 #include "util/io.h"
 #include "kernel/environment.h"
@@ -173,20 +174,64 @@ environment environment::add_definition(declaration const & d, bool check) const
     }
 }
 
+static void check_theorem_value(environment const & env, declaration const & d, type_checker & checker) {
+    theorem_val const & v = d.to_theorem_val();
+    check_no_metavar_no_fvar(env, v.get_name(), v.get_value());
+    expr val_type = checker.check(v.get_value(), v.get_lparams());
+    if (!checker.is_def_eq(val_type, v.get_type()))
+        throw definition_type_mismatch_exception(env, d, val_type);
+}
+
 environment environment::add_theorem(declaration const & d, bool check) const {
     theorem_val const & v = d.to_theorem_val();
     if (check) {
-        // TODO(Leo): we must add support for handling tasks here
         type_checker checker(*this);
         check_constant_val(*this, v.to_constant_val(), checker);
-        check_no_metavar_no_fvar(*this, v.get_name(), v.get_value());
-        expr val_type = checker.check(v.get_value(), v.get_lparams());
-        if (!checker.is_def_eq(val_type, v.get_type()))
-            throw definition_type_mismatch_exception(*this, d, val_type);
+        check_theorem_value(*this, d, checker);
     }
     return add(constant_info(d));
 }
 
+/* Task checking the value of the theorem `decl` in `env`, see `environment::add_async`. */
+static obj_res check_theorem_value_fn(obj_arg env, obj_arg decl, obj_arg max_heartbeat, obj_arg) {
+    size_t max = unbox_size_t(max_heartbeat);
+    dec(max_heartbeat);
+    scope_max_heartbeat scope(max);
+    // stop checking when the task is canceled, i.e. when the environment holding it has been dropped
+    scoped_interrupt_on_task_cancel scope_cancel;
+    environment e(env);
+    declaration d(decl);
+    return catch_kernel_exceptions<object_ref>([&]() {
+            try {
+                type_checker checker(e);
+                check_theorem_value(e, d, checker);
+            } catch (interrupted & ex) {
+                throw exception(ex.what());
+            }
+            return object_ref(box(0));
+        });
+}
+
+environment environment::add_async(declaration const & d, object_ref & value_check) const {
+    if (d.kind() != declaration_kind::Theorem) {
+        environment new_env = add(d);
+        value_check = object_ref(lean_task_pure(mk_cnstr(1, object_ref(box(0))).steal()));
+        return new_env;
+    }
+    /* The theorem is added as soon as its type has been checked, so that later declarations can use it while its
+       value, which usually dominates the checking time, is checked in the background. The value is checked in
+       `*this` as in `add_theorem`. */
+    check_constant_val(*this, d.to_theorem_val().to_constant_val(), true);
+    object * c = lean_alloc_closure((void*)check_theorem_value_fn, 4, 3);
+    lean_closure_set(c, 0, to_obj_arg());
+    lean_closure_set(c, 1, d.to_obj_arg());
+    lean_closure_set(c, 2, box_size_t(get_max_heartbeat()));
+    // not kept alive: the check is canceled when the environment holding the task is dropped, e.g. on backtracking.
+    // A check that has not started yet is not run, a running check stops at its next `check_system`.
+    value_check = object_ref(lean_task_spawn_core(c, 0, /* keep_alive */ false));
+    return add(constant_info(d));
+}
+
 environment environment::add_opaque(declaration const & d, bool check) const {
     opaque_val const & v = d.to_opaque_val();
     if (check) {
@@ -252,6 +297,15 @@ extern "C" LEAN_EXPORT object * lean_add_decl(object * env, object * decl) {
         });
 }
 
+/* addDeclAsync (env : Environment) (decl : @& Declaration) : Except KernelException (Environment × Task (Except KernelException Unit)) */
+extern "C" LEAN_EXPORT object * lean_add_decl_async(object * env, object * decl) {
+    return catch_kernel_exceptions<object_ref>([&]() {
+            object_ref value_check;
+            environment new_env = environment(env).add_async(declaration(decl, true), value_check);
+            return mk_cnstr(0, new_env, value_check);
+        });
+}
+
 void environment::for_each_constant(std::function<void(constant_info const & d)> const & f) const {
     smap_foreach(cnstr_get(raw(), 1), [&](object *, object * v) {
             constant_info cinfo(v, true);
@@ -74,6 +74,10 @@ public:
     /** \brief Extends the current environment with the given declaration */
     environment add(declaration const & d, bool check = true) const;
 
+    /** \brief Same as \c add, but the value of a theorem is type checked in a task, which is stored in \c value_check.
+        The task returns an `Except KernelException Unit`. For other declarations, \c value_check is a finished task. */
+    environment add_async(declaration const & d, object_ref & value_check) const;
+
     /** \brief Apply the function \c f to each constant */
     void for_each_constant(std::function<void(constant_info const & d)> const & f) const;
 
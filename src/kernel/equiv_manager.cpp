@@ -45,11 +45,10 @@ void equiv_manager::merge(node_ref n1, node_ref n2) {
 }
 
 auto equiv_manager::to_node(expr const & e) -> node_ref {
-    auto it = m_to_node.find(e);
-    if (it != m_to_node.end())
-        return it->second;
+    if (node_ref * it = m_to_node.find(e))
+        return *it;
     node_ref r = mk_node();
-    m_to_node.insert(mk_pair(e, r));
+    m_to_node.insert(e, r);
     return r;
 }
 
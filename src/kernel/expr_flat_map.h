@@ -0,0 +1,62 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <utility>
+#include "runtime/flat_hash_table.h"
+#include "kernel/expr.h"
+
+namespace lean {
+/** \brief Open addressing map from expressions to values based on structural equality, see `flat_hash_table`.
+
+    The hash of each key is stored next to it, and keys with the same hash are compared by pointer before they are
+    compared structurally. Entries cannot be erased, and `clear` keeps the allocated slots. It replaces `expr_map` in
+    caches that are only queried and extended. */
+template<typename T>
+class expr_flat_map {
+    typedef std::pair<expr, T> entry;
+    flat_hash_table<entry> m_table;
+public:
+    explicit expr_flat_map(size_t initial_capacity = flat_hash_table<entry>::group_size):m_table(initial_capacity) {}
+
+    T * find(expr const & e) {
+        entry * r = m_table.find(hash(e), [&](entry const & p) { return is_eqp(p.first, e) || p.first == e; });
+        return r ? &r->second : nullptr;
+    }
+
+    /** \brief Insert `(e, v)` unless the map already contains `e`. */
+    void insert(expr const & e, T const & v) {
+        if (!find(e))
+            m_table.insert(hash(e), entry(e, v));
+    }
+
+    size_t size() const { return m_table.size(); }
+    void reserve(size_t n) { m_table.reserve(n); }
+    void clear() { m_table.clear(); }
+};
+
+/** \brief Open addressing set of pairs of expressions based on structural equality, see `expr_flat_map`. */
+class expr_pair_flat_set {
+    flat_hash_table<expr_pair> m_table;
+    static bool eq(expr_pair const & p, expr const & a, expr const & b) {
+        return (is_eqp(p.first, a) || p.first == a) && (is_eqp(p.second, b) || p.second == b);
+    }
+public:
+    explicit expr_pair_flat_set(size_t initial_capacity = flat_hash_table<expr_pair>::group_size):m_table(initial_capacity) {}
+
+    bool contains(expr const & a, expr const & b) {
+        return m_table.find(hash(hash(a), hash(b)), [&](expr_pair const & p) { return eq(p, a, b); }) != nullptr;
+    }
+
+    /** \brief Insert `(a, b)` unless the set already contains it. */
+    void insert(expr const & a, expr const & b) {
+        if (!contains(a, b))
+            m_table.insert(hash(hash(a), hash(b)), expr_pair(a, b));
+    }
+
+    size_t size() const { return m_table.size(); }
+    void reserve(size_t n) { m_table.reserve(n); }
+    void clear() { m_table.clear(); }
+};
+}
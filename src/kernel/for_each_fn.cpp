@@ -11,40 +11,28 @@ Author: Leonardo de Moura
 #include "runtime/flet.h"
 #include "kernel/for_each_fn.h"
 #include "kernel/cache_stack.h"
+#include "kernel/traversal_cache.h"
 
 #ifndef LEAN_DEFAULT_FOR_EACH_CACHE_CAPACITY
 #define LEAN_DEFAULT_FOR_EACH_CACHE_CAPACITY 1024*8
 #endif
 
+#ifndef LEAN_MAX_FOR_EACH_CACHE_CAPACITY
+#define LEAN_MAX_FOR_EACH_CACHE_CAPACITY 1024*1024
+#endif
+
 namespace lean {
-struct for_each_cache {
-    struct entry {
-        object const *    m_cell;
-        unsigned          m_offset;
-        entry():m_cell(nullptr) {}
-    };
-    unsigned              m_capacity;
-    std::vector<entry>    m_cache;
-    std::vector<unsigned> m_used;
-    for_each_cache(unsigned c):m_capacity(c), m_cache(c) {}
+static traversal_cache_counters g_for_each_cache_counters;
+
+struct for_each_cache : public traversal_cache<traversal_cache_entry> {
+    for_each_cache(unsigned c):
+        traversal_cache<traversal_cache_entry>(c, LEAN_MAX_FOR_EACH_CACHE_CAPACITY, g_for_each_cache_counters) {}
 
     bool visited(expr const & e, unsigned offset) {
-        unsigned i = hash(hash(e), offset) % m_capacity;
-        if (m_cache[i].m_cell == e.raw() && m_cache[i].m_offset == offset) {
+        if (find(e, offset))
             return true;
-        } else {
-            if (m_cache[i].m_cell == nullptr)
-                m_used.push_back(i);
-            m_cache[i].m_cell   = e.raw();
-            m_cache[i].m_offset = offset;
-            return false;
-        }
-    }
-
-    void clear() {
-        for (unsigned i : m_used)
-            m_cache[i].m_cell = nullptr;
-        m_used.clear();
+        insert(e, offset);
+        return false;
     }
 };
 
@@ -121,4 +109,8 @@ public:
 void for_each(expr const & e, std::function<bool(expr const &, unsigned)> && f) { // NOLINT
     return for_each_fn(f)(e);
 }
+
+traversal_cache_stats get_for_each_cache_stats() {
+    return g_for_each_cache_counters.get();
+}
 }
@@ -11,6 +11,7 @@ Author: Leonardo de Moura
 #include "runtime/buffer.h"
 #include "kernel/expr.h"
 #include "kernel/expr_sets.h"
+#include "kernel/traversal_cache.h"
 
 namespace lean {
 /** \brief Expression visitor.
@@ -24,4 +25,7 @@ namespace lean {
     The \c offset is the number of binders under which \c e occurs.
 */
 void for_each(expr const & e, std::function<bool(expr const &, unsigned)> && f); // NOLINT
+
+/** \brief Statistics of the caches used by `for_each` in all threads. */
+traversal_cache_stats get_for_each_cache_stats();
 }
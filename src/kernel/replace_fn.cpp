@@ -8,48 +8,26 @@ Author: Leonardo de Moura
 #include <memory>
 #include "kernel/replace_fn.h"
 #include "kernel/cache_stack.h"
+#include "kernel/traversal_cache.h"
 
 #ifndef LEAN_DEFAULT_REPLACE_CACHE_CAPACITY
 #define LEAN_DEFAULT_REPLACE_CACHE_CAPACITY 1024*8
 #endif
 
-namespace lean {
-struct replace_cache {
-    struct entry {
-        object  *  m_cell;
-        unsigned   m_offset;
-        expr       m_result;
-        entry():m_cell(nullptr) {}
-    };
-    unsigned              m_capacity;
-    std::vector<entry>    m_cache;
-    std::vector<unsigned> m_used;
-    replace_cache(unsigned c):m_capacity(c), m_cache(c) {}
+#ifndef LEAN_MAX_REPLACE_CACHE_CAPACITY
+#define LEAN_MAX_REPLACE_CACHE_CAPACITY 1024*1024
+#endif
 
-    expr * find(expr const & e, unsigned offset) {
-        unsigned i = hash(hash(e), offset) % m_capacity;
-        if (m_cache[i].m_cell == e.raw() && m_cache[i].m_offset == offset)
-            return &m_cache[i].m_result;
-        else
-            return nullptr;
-    }
+namespace lean {
+struct replace_cache_entry : public traversal_cache_entry {
+    expr m_result;
+};
 
-    void insert(expr const & e, unsigned offset, expr const & v) {
-        unsigned i = hash(hash(e), offset) % m_capacity;
-        if (m_cache[i].m_cell == nullptr)
-            m_used.push_back(i);
-        m_cache[i].m_cell   = e.raw();
-        m_cache[i].m_offset = offset;
-        m_cache[i].m_result = v;
-    }
+static traversal_cache_counters g_replace_cache_counters;
 
-    void clear() {
-        for (unsigned i : m_used) {
-            m_cache[i].m_cell   = nullptr;
-            m_cache[i].m_result = expr();
-        }
-        m_used.clear();
-    }
+struct replace_cache : public traversal_cache<replace_cache_entry> {
+    replace_cache(unsigned c):
+        traversal_cache<replace_cache_entry>(c, LEAN_MAX_REPLACE_CACHE_CAPACITY, g_replace_cache_counters) {}
 };
 
 /* CACHE_RESET: NO */
@@ -62,7 +40,7 @@ class replace_rec_fn {
 
     expr save_result(expr const & e, unsigned offset, expr const & r, bool shared) {
         if (shared)
-            m_cache->insert(e, offset, r);
+            m_cache->insert(e, offset).m_result = r;
         return r;
     }
 
@@ -70,7 +48,7 @@ class replace_rec_fn {
         bool shared = false;
         if (m_use_cache && is_shared(e)) {
             if (auto r = m_cache->find(e, offset))
-                return *r;
+                return r->m_result;
             shared = true;
         }
         check_system("replace");
@@ -121,4 +99,8 @@ public:
 expr replace(expr const & e, std::function<optional<expr>(expr const &, unsigned)> const & f, bool use_cache) {
     return replace_rec_fn(f, use_cache)(e);
 }
+
+traversal_cache_stats get_replace_cache_stats() {
+    return g_replace_cache_counters.get();
+}
 }
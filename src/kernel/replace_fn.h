@@ -9,6 +9,7 @@ Author: Leonardo de Moura
 #include "runtime/interrupt.h"
 #include "kernel/expr.h"
 #include "kernel/expr_maps.h"
+#include "kernel/traversal_cache.h"
 
 namespace lean {
 /**
@@ -23,4 +24,7 @@ expr replace(expr const & e, std::function<optional<expr>(expr const &, unsigned
 inline expr replace(expr const & e, std::function<optional<expr>(expr const &)> const & f, bool use_cache = true) {
     return replace(e, [&](expr const & e, unsigned) { return f(e); }, use_cache);
 }
+
+/** \brief Statistics of the caches used by `replace` in all threads. */
+traversal_cache_stats get_replace_cache_stats();
 }
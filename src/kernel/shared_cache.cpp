@@ -0,0 +1,84 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <algorithm>
+#include "kernel/shared_cache.h"
+
+namespace lean {
+LEAN_THREAD_PTR(shared_kernel_cache, g_shared_kernel_cache);
+
+shared_kernel_cache::shared_kernel_cache(size_t capacity):
+    m_shard_capacity(std::max<size_t>(1, capacity / num_shards)),
+    m_shards(new shard[num_kinds * num_shards]) {
+}
+
+auto shared_kernel_cache::get_shard(kind k, expr const & e) const -> shard & {
+    return m_shards[static_cast<unsigned>(k) * num_shards + hash(e) % num_shards];
+}
+
+optional<expr> shared_kernel_cache::find(kind k, expr const & e) {
+    shard & s = get_shard(k, e);
+    lock_guard<mutex> lock(s.m_mutex);
+    auto it = s.m_index.find(e);
+    if (it != s.m_index.end()) {
+        entry & r = s.m_entries[it->second];
+        r.m_referenced = true;
+        s.m_stats.m_hits++;
+        return some_expr(r.m_value);
+    }
+    s.m_stats.m_misses++;
+    return none_expr();
+}
+
+void shared_kernel_cache::insert(kind k, expr const & e, expr const & v) {
+    // the entries can be used and freed by other threads
+    mark_mt(e.raw());
+    mark_mt(v.raw());
+    shard & s = get_shard(k, e);
+    lock_guard<mutex> lock(s.m_mutex);
+    if (s.m_index.find(e) != s.m_index.end())
+        return;
+    if (s.m_entries.size() < m_shard_capacity) {
+        s.m_index.insert(mk_pair(e, static_cast<unsigned>(s.m_entries.size())));
+        s.m_entries.push_back(entry{e, v, false});
+        return;
+    }
+    // clock eviction: give referenced entries a second chance
+    while (s.m_entries[s.m_hand].m_referenced) {
+        s.m_entries[s.m_hand].m_referenced = false;
+        s.m_hand = (s.m_hand + 1) % s.m_entries.size();
+    }
+    entry & victim = s.m_entries[s.m_hand];
+    s.m_index.erase(victim.m_key);
+    victim = entry{e, v, false};
+    s.m_index.insert(mk_pair(e, static_cast<unsigned>(s.m_hand)));
+    s.m_hand = (s.m_hand + 1) % s.m_entries.size();
+    s.m_stats.m_evictions++;
+}
+
+auto shared_kernel_cache::get_stats(kind k) -> stats {
+    stats r;
+    for (unsigned i = 0; i < num_shards; i++) {
+        shard & s = m_shards[static_cast<unsigned>(k) * num_shards + i];
+        lock_guard<mutex> lock(s.m_mutex);
+        r.m_hits      += s.m_stats.m_hits;
+        r.m_misses    += s.m_stats.m_misses;
+        r.m_evictions += s.m_stats.m_evictions;
+    }
+    return r;
+}
+
+shared_kernel_cache * get_shared_kernel_cache() {
+    return g_shared_kernel_cache;
+}
+
+scope_shared_kernel_cache::scope_shared_kernel_cache(shared_kernel_cache * c):
+    m_old(g_shared_kernel_cache) {
+    g_shared_kernel_cache = c;
+}
+
+scope_shared_kernel_cache::~scope_shared_kernel_cache() {
+    g_shared_kernel_cache = m_old;
+}
+}
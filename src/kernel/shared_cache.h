@@ -0,0 +1,70 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <memory>
+#include <vector>
+#include "runtime/thread.h"
+#include "kernel/expr.h"
+#include "kernel/expr_maps.h"
+
+namespace lean {
+/** \brief Bounded cache for the `whnf` and `infer_type` results of closed terms, shared by the type checkers created
+    in the scopes of `scope_shared_kernel_cache` installing it, which may run in different threads.
+
+    A result computed in an environment is valid in every environment extending it. Thus, the type checkers sharing a
+    cache must use environments extending one another, as when replaying a sequence of declarations. The cache must not
+    be installed when declarations can be dropped and replaced by different declarations of the same name.
+
+    Each kind of result is stored in a fixed number of shards, each protected by its own mutex. A full shard evicts
+    entries using the clock algorithm. Statistics are counted per shard, under its mutex. */
+class shared_kernel_cache {
+public:
+    /* `Infer` results are computed with `infer_only = true`, `Check` results with `infer_only = false`. */
+    enum class kind { Whnf, WhnfCore, Infer, Check };
+    static constexpr unsigned num_kinds = 4;
+    struct stats {
+        uint64 m_hits      = 0;
+        uint64 m_misses    = 0;
+        uint64 m_evictions = 0;
+    };
+private:
+    struct entry {
+        expr m_key;
+        expr m_value;
+        bool m_referenced;
+    };
+    struct shard {
+        mutex              m_mutex;
+        expr_map<unsigned> m_index;
+        std::vector<entry> m_entries;
+        size_t             m_hand = 0;
+        stats              m_stats;
+    };
+    static constexpr unsigned num_shards = 64;
+    size_t                   m_shard_capacity;
+    std::unique_ptr<shard[]> m_shards;
+    shard & get_shard(kind k, expr const & e) const;
+public:
+    /* Create a cache storing up to `capacity` results of each kind. */
+    explicit shared_kernel_cache(size_t capacity);
+    shared_kernel_cache(shared_kernel_cache const &) = delete;
+    shared_kernel_cache & operator=(shared_kernel_cache const &) = delete;
+    optional<expr> find(kind k, expr const & e);
+    void insert(kind k, expr const & e, expr const & v);
+    stats get_stats(kind k);
+};
+
+/** \brief Return the shared cache used by type checkers created in the current thread, if any. */
+shared_kernel_cache * get_shared_kernel_cache();
+
+/** \brief Install `c` as the shared cache of type checkers created in the current thread until the end of the scope.
+    Tasks using the cache install it themselves. */
+class scope_shared_kernel_cache {
+    shared_kernel_cache * m_old;
+public:
+    scope_shared_kernel_cache(shared_kernel_cache * c);
+    ~scope_shared_kernel_cache();
+};
+}
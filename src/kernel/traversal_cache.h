@@ -0,0 +1,154 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include "kernel/expr.h"
+
+namespace lean {
+/** \brief Statistics of the caches used by expression traversals such as `replace` and `for_each`. */
+struct traversal_cache_stats {
+    uint64 m_hits      = 0;
+    uint64 m_misses    = 0;
+    uint64 m_evictions = 0;
+    uint64 m_resizes   = 0;
+};
+
+inline std::ostream & operator<<(std::ostream & out, traversal_cache_stats const & s) {
+    return out << s.m_hits << " hits, " << s.m_misses << " misses, " << s.m_evictions << " evictions, "
+               << s.m_resizes << " resizes";
+}
+
+/** \brief Process-wide statistics of a kind of traversal cache. Each cache counts locally, and adds its counters here
+    when it is cleared. Caches are used by many threads and cleared after every traversal, so the counters are split
+    into stripes on their own cache lines, each cache adds to the stripe assigned to it on creation, and `get` adds up
+    the stripes. */
+class traversal_cache_counters {
+    struct alignas(64) stripe {
+        std::atomic<uint64> m_hits{0};
+        std::atomic<uint64> m_misses{0};
+        std::atomic<uint64> m_evictions{0};
+        std::atomic<uint64> m_resizes{0};
+    };
+    static constexpr unsigned num_stripes = 64;
+    stripe                m_stripes[num_stripes];
+    std::atomic<unsigned> m_next_stripe{0};
+public:
+    unsigned mk_stripe() { return m_next_stripe.fetch_add(1, std::memory_order_relaxed) % num_stripes; }
+    void add(unsigned i, traversal_cache_stats const & s) {
+        stripe & r = m_stripes[i];
+        if (s.m_hits > 0)
+            r.m_hits.fetch_add(s.m_hits, std::memory_order_relaxed);
+        if (s.m_misses > 0)
+            r.m_misses.fetch_add(s.m_misses, std::memory_order_relaxed);
+        if (s.m_evictions > 0)
+            r.m_evictions.fetch_add(s.m_evictions, std::memory_order_relaxed);
+        if (s.m_resizes > 0)
+            r.m_resizes.fetch_add(s.m_resizes, std::memory_order_relaxed);
+    }
+    traversal_cache_stats get() const {
+        traversal_cache_stats s;
+        for (stripe const & r : m_stripes) {
+            s.m_hits      += r.m_hits.load(std::memory_order_relaxed);
+            s.m_misses    += r.m_misses.load(std::memory_order_relaxed);
+            s.m_evictions += r.m_evictions.load(std::memory_order_relaxed);
+            s.m_resizes   += r.m_resizes.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+};
+
+/** \brief Base class for the entries of `traversal_cache`. */
+struct traversal_cache_entry {
+    object const * m_cell = nullptr;
+    unsigned       m_offset = 0;
+    unsigned       m_hash = 0;
+};
+
+/** \brief Direct-mapped cache indexed by a shared expression cell and the number of binders it occurs under, used
+    by expression traversals. `Entry` must extend `traversal_cache_entry`.
+
+    Entries are overwritten on collision. A collision evicting an entry while at least half of the slots are in use
+    means the traversed term does not fit in the cache, and the capacity is doubled up to `max_capacity`. Otherwise,
+    the hit rate collapses on huge terms, and traversals become exponential in the amount of sharing. The capacity
+    goes back to the initial one when the cache is cleared. Capacities must be powers of two. */
+template<typename Entry>
+class traversal_cache {
+    unsigned                   m_initial_capacity;
+    unsigned                   m_max_capacity;
+    unsigned                   m_capacity;
+    std::vector<Entry>         m_cache;
+    std::vector<unsigned>      m_used;
+    traversal_cache_stats      m_stats;
+    traversal_cache_counters & m_counters;
+    unsigned                   m_counters_stripe;
+
+    void grow() {
+        std::vector<Entry> old_cache = std::move(m_cache);
+        std::vector<unsigned> old_used = std::move(m_used);
+        m_capacity *= 2;
+        m_cache = std::vector<Entry>(m_capacity);
+        m_used.clear();
+        // the entry at `i` moves to either `i` or `i + old capacity`, so entries never collide here
+        for (unsigned i : old_used) {
+            unsigned j = old_cache[i].m_hash & (m_capacity - 1);
+            m_cache[j] = std::move(old_cache[i]);
+            m_used.push_back(j);
+        }
+        m_stats.m_resizes++;
+    }
+public:
+    traversal_cache(unsigned capacity, unsigned max_capacity, traversal_cache_counters & counters):
+        m_initial_capacity(capacity), m_max_capacity(max_capacity), m_capacity(capacity), m_cache(capacity),
+        m_counters(counters), m_counters_stripe(counters.mk_stripe()) {
+        lean_assert((capacity & (capacity - 1)) == 0);
+    }
+
+    Entry * find(expr const & e, unsigned offset) {
+        Entry & r = m_cache[hash(hash(e), offset) & (m_capacity - 1)];
+        if (r.m_cell == e.raw() && r.m_offset == offset) {
+            m_stats.m_hits++;
+            return &r;
+        } else {
+            m_stats.m_misses++;
+            return nullptr;
+        }
+    }
+
+    /** \brief Return the entry for `(e, offset)`, evicting the entry previously stored in its slot. The caller fills
+        in the remaining fields. */
+    Entry & insert(expr const & e, unsigned offset) {
+        unsigned h = hash(hash(e), offset);
+        unsigned i = h & (m_capacity - 1);
+        if (m_cache[i].m_cell != nullptr && 2 * m_used.size() >= m_capacity && m_capacity < m_max_capacity) {
+            grow();
+            i = h & (m_capacity - 1);
+        }
+        Entry & r = m_cache[i];
+        if (r.m_cell == nullptr)
+            m_used.push_back(i);
+        else if (r.m_cell != e.raw() || r.m_offset != offset)
+            m_stats.m_evictions++;
+        r.m_cell   = e.raw();
+        r.m_offset = offset;
+        r.m_hash   = h;
+        return r;
+    }
+
+    void clear() {
+        if (m_capacity != m_initial_capacity) {
+            m_capacity = m_initial_capacity;
+            std::vector<Entry>(m_capacity).swap(m_cache);
+        } else {
+            for (unsigned i : m_used)
+                m_cache[i] = Entry();
+        }
+        m_used.clear();
+        m_counters.add(m_counters_stripe, m_stats);
+        m_stats = traversal_cache_stats();
+    }
+};
+}
@@ -36,7 +36,7 @@ static expr * g_nat_beq      = nullptr;
 static expr * g_nat_ble      = nullptr;
 
 type_checker::state::state(environment const & env):
-    m_env(env), m_ngen(*g_kernel_fresh) {}
+    m_env(env), m_ngen(*g_kernel_fresh), m_shared_cache(get_shared_kernel_cache()) {}
 
 /** \brief Make sure \c e "is" a sort, and return the corresponding sort.
     If \c e is not a sort, then the whnf procedure is invoked.
@@ -279,6 +279,18 @@ expr type_checker::infer_proj(expr const & e, bool infer_only) {
     return r;
 }
 
+/** \brief Return the shared cache if the results of `infer_type_core(e, infer_only)`, or `whnf(e)` if `infer_only`, can
+    be shared with other type checkers. This is the case if they do not depend on the local context or on the settings of
+    this type checker: `e` must be closed, and when `e` is checked, it must not contain universe parameters, which are
+    checked against `m_lparams`, and it must be checked in safe mode, which is the most restrictive one. */
+shared_kernel_cache * type_checker::get_shared_cache(expr const & e, bool infer_only) const {
+    if (!m_st->m_shared_cache || has_fvar(e) || has_mvar(e))
+        return nullptr;
+    if (!infer_only && (has_univ_param(e) || m_definition_safety != definition_safety::safe))
+        return nullptr;
+    return m_st->m_shared_cache;
+}
+
 /** \brief Return type of expression \c e, if \c infer_only is false, then it also check whether \c e is type correct or not.
     \pre closed(e) */
 expr type_checker::infer_type_core(expr const & e, bool infer_only) {
@@ -288,9 +300,17 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     lean_assert(!has_loose_bvars(e));
     check_system("type checker");
 
-    auto it = m_st->m_infer_type[infer_only].find(e);
-    if (it != m_st->m_infer_type[infer_only].end())
-        return it->second;
+    if (expr * it = m_st->m_infer_type[infer_only].find(e))
+        return *it;
+
+    auto shared_kind = infer_only ? shared_kernel_cache::kind::Infer : shared_kernel_cache::kind::Check;
+    shared_kernel_cache * shared = get_shared_cache(e, infer_only);
+    if (shared) {
+        if (auto r = shared->find(shared_kind, e)) {
+            m_st->m_infer_type[infer_only].insert(e, *r);
+            return *r;
+        }
+    }
 
     expr r;
     switch (e.kind()) {
@@ -312,7 +332,9 @@ expr type_checker::infer_type_core(expr const & e, bool infer_only) {
     case expr_kind::Let:      r = infer_let(e, infer_only);            break;
     }
 
-    m_st->m_infer_type[infer_only].insert(mk_pair(e, r));
+    m_st->m_infer_type[infer_only].insert(e, r);
+    if (shared)
+        shared->insert(shared_kind, e, r);
     return r;
 }
 
@@ -430,9 +452,15 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     }
 
     // check cache
-    auto it = m_st->m_whnf_core.find(e);
-    if (it != m_st->m_whnf_core.end())
-        return it->second;
+    if (expr * it = m_st->m_whnf_core.find(e))
+        return *it;
+    shared_kernel_cache * shared = !cheap_rec && !cheap_proj ? get_shared_cache(e, true) : nullptr;
+    if (shared) {
+        if (auto r = shared->find(shared_kernel_cache::kind::WhnfCore, e)) {
+            m_st->m_whnf_core.insert(e, *r);
+            return *r;
+        }
+    }
 
     // do the actual work
     expr r;
@@ -482,7 +510,9 @@ expr type_checker::whnf_core(expr const & e, bool cheap_rec, bool cheap_proj) {
     }
 
     if (!cheap_rec && !cheap_proj) {
-        m_st->m_whnf_core.insert(mk_pair(e, r));
+        m_st->m_whnf_core.insert(e, r);
+        if (shared)
+            shared->insert(shared_kernel_cache::kind::WhnfCore, e, r);
     }
     return r;
 }
@@ -631,27 +661,37 @@ expr type_checker::whnf(expr const & e) {
     }
 
     // check cache
-    auto it = m_st->m_whnf.find(e);
-    if (it != m_st->m_whnf.end())
-        return it->second;
+    if (expr * it = m_st->m_whnf.find(e))
+        return *it;
+    shared_kernel_cache * shared = get_shared_cache(e, true);
+    if (shared) {
+        if (auto r = shared->find(shared_kernel_cache::kind::Whnf, e)) {
+            m_st->m_whnf.insert(e, *r);
+            return *r;
+        }
+    }
 
     expr t = e;
+    expr r;
     while (true) {
         expr t1 = whnf_core(t);
         if (auto v = reduce_native(env(), t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto v = reduce_nat(t1)) {
-            m_st->m_whnf.insert(mk_pair(e, *v));
-            return *v;
+            r = *v;
+            break;
         } else if (auto next_t = unfold_definition(t1)) {
             t = *next_t;
         } else {
-            auto r = t1;
-            m_st->m_whnf.insert(mk_pair(e, r));
-            return r;
+            r = t1;
+            break;
         }
     }
+    m_st->m_whnf.insert(e, r);
+    if (shared)
+        shared->insert(shared_kernel_cache::kind::Whnf, e, r);
+    return r;
 }
 
 /** \brief Given lambda/Pi expressions \c t and \c s, return true iff \c t is def eq to \c s.
@@ -818,21 +858,19 @@ lbool type_checker::is_def_eq_proof_irrel(expr const & t, expr const & s) {
 
 bool type_checker::failed_before(expr const & t, expr const & s) const {
     if (hash(t) < hash(s)) {
-        return m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end();
+        return m_st->m_failure.contains(t, s);
     } else if (hash(t) > hash(s)) {
-        return m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
+        return m_st->m_failure.contains(s, t);
     } else {
-        return
-            m_st->m_failure.find(mk_pair(t, s)) != m_st->m_failure.end() ||
-            m_st->m_failure.find(mk_pair(s, t)) != m_st->m_failure.end();
+        return m_st->m_failure.contains(t, s) || m_st->m_failure.contains(s, t);
     }
 }
 
 void type_checker::cache_failure(expr const & t, expr const & s) {
     if (hash(t) <= hash(s))
-        m_st->m_failure.insert(mk_pair(t, s));
+        m_st->m_failure.insert(t, s);
     else
-        m_st->m_failure.insert(mk_pair(s, t));
+        m_st->m_failure.insert(s, t);
 }
 
 /**
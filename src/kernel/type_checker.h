@@ -5,7 +5,6 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #pragma once
-#include <unordered_set>
 #include <memory>
 #include <utility>
 #include <algorithm>
@@ -15,7 +14,9 @@ Author: Leonardo de Moura
 #include "kernel/environment.h"
 #include "kernel/local_ctx.h"
 #include "kernel/expr_maps.h"
+#include "kernel/expr_flat_map.h"
 #include "kernel/equiv_manager.h"
+#include "kernel/shared_cache.h"
 
 namespace lean {
 /** \brief Lean Type Checker. It can also be used to infer types, check whether a
@@ -23,15 +24,16 @@ namespace lean {
 class type_checker {
 public:
     class state {
-        typedef expr_map<expr> infer_cache;
-        typedef std::unordered_set<expr_pair, expr_pair_hash, expr_pair_eq> expr_pair_set;
+        typedef expr_flat_map<expr> infer_cache;
         environment               m_env;
         name_generator            m_ngen;
         infer_cache               m_infer_type[2];
-        expr_map<expr>            m_whnf_core;
-        expr_map<expr>            m_whnf;
+        expr_flat_map<expr>       m_whnf_core;
+        expr_flat_map<expr>       m_whnf;
         equiv_manager             m_eqv_manager;
-        expr_pair_set             m_failure;
+        expr_pair_flat_set        m_failure;
+        // see `shared_kernel_cache`
+        shared_kernel_cache *     m_shared_cache;
         friend type_checker;
     public:
         state(environment const & env);
@@ -58,6 +60,7 @@ private:
     expr infer_app(expr const & e, bool infer_only);
     expr infer_proj(expr const & e, bool infer_only);
     expr infer_let(expr const & e, bool infer_only);
+    shared_kernel_cache * get_shared_cache(expr const & e, bool infer_only) const;
     expr infer_type_core(expr const & e, bool infer_only);
     expr infer_type(expr const & e);
 
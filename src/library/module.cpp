@@ -11,6 +11,7 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include <sstream>
 #include <fstream>
 #include <algorithm>
+#include <memory>
 #include <sys/stat.h>
 #include "runtime/thread.h"
 #include "runtime/interrupt.h"
@@ -20,6 +21,8 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 #include "runtime/compact.h"
 #include "runtime/buffer.h"
 #include "util/io.h"
+#include "githash.h" // NOLINT
+#include "util/lz4.h"
 #include "util/name_map.h"
 #include "library/module.h"
 #include "library/constants.h"
@@ -42,43 +45,535 @@ Authors: Leonardo de Moura, Gabriel Ebner, Sebastian Ullrich
 
 namespace lean {
 // manually padded to multiple of word size, see `initialize_module`
-static char const * g_olean_header   = "oleanfile!!!!!!!";
+// The header is followed by `olean_header_fields`.
+static char const * g_olean_header   = "oleanfile-v3!!!!";
+/* Header of compressed .olean files, which are written instead when `LEAN_OLEAN_COMPRESS` is set.
+   The header is followed by `olean_header_fields`, the offset of the block table, and the blocks of the compacted
+   region, each compressed with LZ4 on its own, or stored as is when that is not smaller. The block table contains the
+   size of the region, the block size, and the offset and stored size of each block. */
+static char const * g_olean_compressed_header = "oleanfile-z3!!!!";
+/* Header of .olean files written by the stage0 compiler, which builds the .olean files of stage1. The header is
+   followed by the base address and the compacted region, without a chunk index. The .olean files of stage1 are read
+   by the stage1 compiler, so this format must be accepted until stage0 is updated. */
+static char const * g_olean_legacy_header = "oleanfile!!!!!!!";
+#define LEAN_OLEAN_BLOCK_SZ (256*1024)
+// number of blocks kept decompressed while writing a compressed .olean file, see `olean_compressor`
+#define LEAN_OLEAN_CACHED_BLOCKS 16
+/* Header of .olean dictionaries, see `get_olean_dictionary`. The header is followed by the base address and the
+   identifier of the dictionary. */
+static char const * g_olean_dictionary_header = "oleandict-v1!!!!";
 
-extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, object *) {
+/* The dictionary an .olean file was written with, all zero if none. */
+struct olean_dictionary_ref {
+    uint64 m_id;
+    uint64 m_base_addr;
+    uint64 m_size;
+};
+
+#define LEAN_OLEAN_GITHASH_SZ 40
+
+/* Fields following the header of .olean files. They can be validated without reading the rest of the file, see
+   `lean_read_olean_header`. */
+struct olean_header_fields {
+    uint64               m_base_addr;
+    olean_dictionary_ref m_dict;
+    // githash of the Lean version that wrote the file, padded with zeros
+    char                 m_githash[LEAN_OLEAN_GITHASH_SZ];
+    // see `object_compactor::content_hash`
+    uint64               m_content_hash;
+    // hash of the .olean files imported by the module, see `writeModule`
+    uint64               m_imports_hash;
+};
+
+static void set_githash(olean_header_fields & fields) {
+    memset(fields.m_githash, 0, LEAN_OLEAN_GITHASH_SZ);
+    memcpy(fields.m_githash, LEAN_GITHASH, std::min(strlen(LEAN_GITHASH), static_cast<size_t>(LEAN_OLEAN_GITHASH_SZ)));
+}
+
+static std::string get_githash(olean_header_fields const & fields) {
+    return std::string(fields.m_githash, strnlen(fields.m_githash, LEAN_OLEAN_GITHASH_SZ));
+}
+
+static std::string mk_olean_header(char const * header, olean_header_fields const & fields) {
+    std::string r(header);
+    r.append(reinterpret_cast<char const *>(&fields), sizeof(fields));
+    return r;
+}
+
+enum class olean_format { Plain, Compressed, Legacy };
+
+/* Read the header of the .olean file `in` of size `size`, and return the format of the file. Files in the
+   `g_olean_legacy_header` format only store the base address, and all other fields are left zero. */
+static olean_format read_olean_header(std::istream & in, size_t size, olean_header_fields & fields) {
+    size_t header_size = strlen(g_olean_header);
+    if (size < header_size + sizeof(fields.m_base_addr))
+        throw exception("invalid header");
+    std::string header(header_size, ' ');
+    in.read(&header[0], header_size);
+    if (in && header == g_olean_legacy_header) {
+        memset(&fields, 0, sizeof(fields));
+        in.read(reinterpret_cast<char *>(&fields.m_base_addr), sizeof(fields.m_base_addr));
+        if (!in)
+            throw exception("invalid header");
+        return olean_format::Legacy;
+    }
+    if (size < header_size + sizeof(fields))
+        throw exception("invalid header");
+    in.read(reinterpret_cast<char *>(&fields), sizeof(fields));
+    bool compressed = header == g_olean_compressed_header;
+    if (!in || (!compressed && header != g_olean_header))
+        throw exception("invalid header");
+    return compressed ? olean_format::Compressed : olean_format::Plain;
+}
+
+static bool olean_compression_enabled() {
+#ifndef LEAN_EMSCRIPTEN
+    static bool enabled = std::getenv("LEAN_OLEAN_COMPRESS") != nullptr;
+    return enabled;
+#else
+    return false;
+#endif
+}
+
+#ifndef LEAN_WINDOWS
+static void pwrite_all(int fd, char const * data, size_t sz, size_t offset) {
+    while (sz > 0) {
+        ssize_t n = pwrite(fd, data, sz, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw exception(strerror(errno));
+        }
+        data += n; sz -= n; offset += n;
+    }
+}
+
+static void pread_all(int fd, char * data, size_t sz, size_t offset) {
+    while (sz > 0) {
+        ssize_t n = pread(fd, data, sz, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            throw exception(n < 0 ? strerror(errno) : "unexpected end of file");
+        }
+        data += n; sz -= n; offset += n;
+    }
+}
+
+/* Sink of the compactor that compresses the compacted region into the blocks of the compressed .olean file `fd` while
+   it is flushed, see `g_olean_compressed_header`. The first block is only compressed by `finish` since it contains the
+   root, which is written last, and it is stored after the other blocks. Data of other blocks that is read back for max
+   sharing is decompressed from the file again. */
+class olean_compressor : public compactor_sink {
+    int                 m_fd;
+    // size of the region data written so far
+    size_t              m_size = 0;
+    size_t              m_file_end;
+    std::vector<char>   m_first;
+    // the current block, if it is not the first one
+    std::vector<char>   m_last;
+    // offset and stored size of each block, the first block is stored by `finish`
+    std::vector<uint64> m_blocks;
+    std::vector<char>   m_compressed;
+    // recently read blocks, indexed by the block index modulo `LEAN_OLEAN_CACHED_BLOCKS`
+    std::vector<char>   m_cache[LEAN_OLEAN_CACHED_BLOCKS];
+    // index of the block in each entry of `m_cache`, 0 for none since the first block is never cached
+    size_t              m_cached[LEAN_OLEAN_CACHED_BLOCKS];
+    std::vector<char>   m_read;
+
+    void write_block(std::vector<char> const & block) {
+        size_t n = block.size();
+        m_compressed.resize(lz4_compress_bound(n));
+        size_t c = lz4_compress(block.data(), n, m_compressed.data());
+        char const * data = c < n ? m_compressed.data() : block.data();
+        size_t data_sz    = c < n ? c : n;
+        pwrite_all(m_fd, data, data_sz, m_file_end);
+        m_blocks.push_back(m_file_end);
+        m_blocks.push_back(data_sz);
+        m_file_end += data_sz;
+    }
+
+    char const * block_data(size_t i) {
+        if (i == 0)
+            return m_first.data();
+        if (i == m_size / LEAN_OLEAN_BLOCK_SZ)
+            return m_last.data();
+        std::vector<char> & block = m_cache[i % LEAN_OLEAN_CACHED_BLOCKS];
+        size_t & cached = m_cached[i % LEAN_OLEAN_CACHED_BLOCKS];
+        if (cached != i) {
+            // all blocks but the last one are full
+            size_t offset = m_blocks[2*i];
+            size_t sz     = m_blocks[2*i + 1];
+            block.resize(LEAN_OLEAN_BLOCK_SZ);
+            if (sz == LEAN_OLEAN_BLOCK_SZ) {
+                pread_all(m_fd, block.data(), sz, offset);
+            } else {
+                m_compressed.resize(sz);
+                pread_all(m_fd, m_compressed.data(), sz, offset);
+                if (!lz4_decompress(m_compressed.data(), sz, block.data(), LEAN_OLEAN_BLOCK_SZ))
+                    throw exception("corrupted block");
+            }
+            cached = i;
+        }
+        return block.data();
+    }
+public:
+    olean_compressor(int fd, size_t data_offset):m_fd(fd), m_file_end(data_offset), m_blocks(2, 0) {
+        std::fill(m_cached, m_cached + LEAN_OLEAN_CACHED_BLOCKS, 0);
+    }
+
+    void write(size_t offset, char const * data, size_t sz) override {
+        if (offset < m_size) {
+            lean_assert(offset + sz <= m_first.size());
+            memcpy(m_first.data() + offset, data, sz);
+            return;
+        }
+        lean_assert(offset == m_size);
+        while (sz > 0) {
+            std::vector<char> & block = m_size < LEAN_OLEAN_BLOCK_SZ ? m_first : m_last;
+            size_t n = std::min(sz, LEAN_OLEAN_BLOCK_SZ - block.size());
+            block.insert(block.end(), data, data + n);
+            data += n; sz -= n; m_size += n;
+            if (&block == &m_last && m_last.size() == LEAN_OLEAN_BLOCK_SZ) {
+                write_block(m_last);
+                m_last.clear();
+            }
+        }
+    }
+
+    char const * read(size_t offset, size_t sz) override {
+        lean_assert(offset + sz <= m_size);
+        size_t i = offset / LEAN_OLEAN_BLOCK_SZ;
+        size_t j = (offset + sz - 1) / LEAN_OLEAN_BLOCK_SZ;
+        if (i == j)
+            return block_data(i) + offset % LEAN_OLEAN_BLOCK_SZ;
+        m_read.resize(sz);
+        for (size_t n = 0; n < sz;) {
+            size_t k = (offset + n) % LEAN_OLEAN_BLOCK_SZ;
+            size_t m = std::min(sz - n, LEAN_OLEAN_BLOCK_SZ - k);
+            memcpy(m_read.data() + n, block_data((offset + n) / LEAN_OLEAN_BLOCK_SZ) + k, m);
+            n += m;
+        }
+        return m_read.data();
+    }
+
+    /* Write the remaining blocks, the block table, and the header with `fields`. */
+    void finish(olean_header_fields const & fields) {
+        if (!m_last.empty())
+            write_block(m_last);
+        write_block(m_first);
+        m_blocks[0] = m_blocks[m_blocks.size() - 2];
+        m_blocks[1] = m_blocks[m_blocks.size() - 1];
+        m_blocks.resize(m_blocks.size() - 2);
+        std::vector<uint64> table = {m_size, LEAN_OLEAN_BLOCK_SZ};
+        table.insert(table.end(), m_blocks.begin(), m_blocks.end());
+        pwrite_all(m_fd, reinterpret_cast<char const *>(table.data()), sizeof(uint64) * table.size(), m_file_end);
+        std::string header = mk_olean_header(g_olean_compressed_header, fields);
+        uint64 table_offset = m_file_end;
+        header.append(reinterpret_cast<char const *>(&table_offset), sizeof(table_offset));
+        pwrite_all(m_fd, header.data(), header.size(), 0);
+    }
+};
+#endif
+
+/* Read the compacted region of a compressed .olean file. If `allow_at_base`, the region is decompressed at its base
+   address when that address is available, so that it does not need to be relocated. */
+static compacted_region * read_compressed_region(std::ifstream & in, char * base_addr, size_t header_size, size_t file_size,
+                                                 bool allow_at_base) {
+    uint64 table_offset;
+    in.read(reinterpret_cast<char *>(&table_offset), sizeof(table_offset));
+    if (!in || table_offset > file_size)
+        throw exception("invalid header");
+    in.seekg(table_offset);
+    uint64 sizes[2];
+    in.read(reinterpret_cast<char *>(sizes), sizeof(sizes));
+    size_t region_size = sizes[0];
+    size_t block_sz    = sizes[1];
+    if (!in || block_sz == 0 || region_size > (static_cast<size_t>(1) << 40))
+        throw exception("invalid header");
+    size_t num_blocks = (region_size + block_sz - 1) / block_sz;
+    if (num_blocks > file_size / (2 * sizeof(uint64)))
+        throw exception("invalid header");
+    // offset and stored size of each block
+    std::vector<uint64> blocks(2 * num_blocks);
+    in.read(reinterpret_cast<char *>(blocks.data()), sizeof(uint64) * blocks.size());
+    if (!in)
+        throw exception("invalid header");
+    char * buffer = nullptr;
+    bool at_base  = false;
+    std::function<void()> free_data;
+#ifndef LEAN_WINDOWS
+    size_t map_size = header_size + region_size;
+    void * mem = allow_at_base ? mmap(base_addr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+    if (mem == base_addr) {
+        buffer    = base_addr + header_size;
+        at_base   = true;
+        free_data = [=]() { lean_always_assert(munmap(base_addr, map_size) == 0); };
+    } else if (mem != MAP_FAILED) {
+        munmap(mem, map_size);
+    }
+#endif
+    if (!buffer) {
+        buffer    = static_cast<char *>(malloc(region_size));
+        free_data = [=]() { free(buffer); };
+    }
+    std::unique_ptr<compacted_region> region(new compacted_region(region_size, buffer, base_addr + header_size, at_base, free_data));
+    std::vector<char> compressed;
+    for (size_t i = 0; i < num_blocks; i++) {
+        size_t n = std::min(block_sz, region_size - i * block_sz);
+        char * block = buffer + i * block_sz;
+        size_t block_offset = blocks[2*i];
+        size_t stored_sz    = blocks[2*i + 1];
+        if (block_offset > file_size)
+            throw exception("corrupted block");
+        in.seekg(block_offset);
+        if (stored_sz == n) {
+            in.read(block, n);
+        } else {
+            if (stored_sz > n)
+                throw exception("corrupted block");
+            compressed.resize(stored_sz);
+            in.read(compressed.data(), compressed.size());
+            if (in && !lz4_decompress(compressed.data(), compressed.size(), block, n))
+                throw exception("corrupted block");
+        }
+        if (!in)
+            throw exception("unexpected end of file");
+    }
+#ifndef LEAN_WINDOWS
+    if (at_base)
+        mprotect(base_addr, map_size, PROT_READ);
+#endif
+    return region.release();
+}
+
+/* Create the compacted region of the .olean file `olean_fn` of size `size`, which starts after the header of size
+   `header_size`. If `allow_mmap`, the file is mapped at `base_addr` when that address is available. Otherwise, the
+   region data must still be read from the file, see `compacted_region::read(std::istream &)`. */
+static compacted_region * mk_olean_region(std::string const & olean_fn, size_t size, char * base_addr, size_t header_size, bool allow_mmap) {
+    char * buffer = nullptr;
+    bool is_mmap = false;
+    std::function<void()> free_data = []() {};
+    if (allow_mmap) {
+#ifdef LEAN_WINDOWS
+        // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
+        HANDLE h_olean_fn = CreateFile(olean_fn.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (h_olean_fn == INVALID_HANDLE_VALUE) {
+            throw exception(sstream() << "failed to open '" << olean_fn << "': " << GetLastError());
+        }
+        HANDLE h_map = CreateFileMapping(h_olean_fn, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (h_olean_fn == NULL) {
+            throw exception(sstream() << "failed to map '" << olean_fn << "': " << GetLastError());
+        }
+        buffer = static_cast<char *>(MapViewOfFileEx(h_map, FILE_MAP_READ, 0, 0, 0, base_addr));
+        free_data = [=]() {
+            if (buffer) {
+                lean_always_assert(UnmapViewOfFile(base_addr));
+            }
+            lean_always_assert(CloseHandle(h_map));
+            lean_always_assert(CloseHandle(h_olean_fn));
+        };
+#else
+        int fd = open(olean_fn.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw exception(sstream() << "failed to open '" << olean_fn << "': " << strerror(errno));
+        }
+        buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        close(fd);
+        free_data = [=]() {
+            if (buffer != MAP_FAILED) {
+                lean_always_assert(munmap(buffer, size) == 0);
+            }
+        };
+#endif
+        is_mmap = buffer == base_addr;
+    }
+    if (is_mmap) {
+        buffer += header_size;
+    } else {
+        free_data();
+        buffer = static_cast<char *>(malloc(size - header_size));
+        free_data = [=]() {
+            free(buffer);
+        };
+    }
+    return new compacted_region(size - header_size, buffer, base_addr + header_size, is_mmap, free_data);
+}
+
+/* Derive a base address from the hash `h` that is uniformly distributed but deterministic, and should most likely
+   work for `mmap` on all interesting platforms.
+   NOTE: an overlapping/non-compatible base address does not prevent the file from being read, merely from using
+   `mmap` for that */
+static size_t mk_olean_base_addr(size_t h) {
+    // x86-64 user space is currently limited to the lower 47 bits
+    // https://en.wikipedia.org/wiki/X86-64#Virtual_address_space_details
+    // On Linux at least, the stack grows down from ~0x7fff... followed by shared libraries, so reserve
+    // a bit of space for them (0x7fff...-0x7f00... = 1TB)
+    size_t base_addr = h % 0x7f0000000000;
+    // `mmap` addresses must be page-aligned. The default (non-huge) page size on x86-64 is 4KB.
+    // `MapViewOfFileEx` addresses must be aligned to the "memory allocation granularity", which is 64KB.
+    return base_addr & ~((1LL<<16) - 1);
+}
+
+/* A compacted region of objects shared by .olean files, for example all objects of the modules of `Init`.
+   .olean files written while a dictionary is loaded reference its objects instead of containing copies of them,
+   see `object_compactor::set_dictionary`, and can only be read with the same dictionary loaded. */
+struct olean_dictionary {
+    uint64             m_id;
+    compacted_region * m_region;
+};
+
+static olean_dictionary * read_olean_dictionary(std::string const & fn) {
+    std::ifstream in(fn, std::ios_base::binary);
+    if (in.fail())
+        throw exception(sstream() << "failed to open .olean dictionary '" << fn << "'");
+    in.seekg(0, in.end);
+    size_t size = in.tellg();
+    in.seekg(0);
+    size_t header_size = strlen(g_olean_dictionary_header) + sizeof(char *) + sizeof(uint64);
+    std::string header(strlen(g_olean_dictionary_header), ' ');
+    char * base_addr = nullptr;
+    uint64 id = 0;
+    if (size >= header_size) {
+        in.read(&header[0], header.size());
+        in.read(reinterpret_cast<char *>(&base_addr), sizeof(base_addr));
+        in.read(reinterpret_cast<char *>(&id), sizeof(id));
+    }
+    if (!in || header != g_olean_dictionary_header)
+        throw exception(sstream() << "failed to read .olean dictionary '" << fn << "', invalid header");
+    std::unique_ptr<compacted_region> region(mk_olean_region(fn, size, base_addr, header_size, true));
+    object * root = region->is_memory_mapped() ? region->read() : region->read(in);
+    if (!root)
+        throw exception(sstream() << "failed to read .olean dictionary '" << fn << "'");
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+    // do not report as leak
+    __lsan_ignore_object(region.get());
+#endif
+#endif
+    return new olean_dictionary{id, region.release()};
+}
+
+/* Return the dictionary given by `LEAN_OLEAN_DICTIONARY`, if any. It is read once and never freed. */
+static olean_dictionary const * get_olean_dictionary() {
+#ifndef LEAN_EMSCRIPTEN
+    // if reading the dictionary fails, it is retried on the next call
+    static olean_dictionary const * dict = []() -> olean_dictionary const * {
+        char const * fn = std::getenv("LEAN_OLEAN_DICTIONARY");
+        return fn && *fn ? read_olean_dictionary(fn) : nullptr;
+    }();
+    return dict;
+#else
+    return nullptr;
+#endif
+}
+
+/* Write the objects of `data` to the .olean dictionary `fname`. */
+extern "C" LEAN_EXPORT object * lean_save_olean_dictionary(b_obj_arg fname, b_obj_arg data, object *) {
+    std::string fn(string_cstr(fname));
+    std::string tmp_fn = fn + ".tmp";
+    try {
+        std::ofstream out(tmp_fn, std::ios_base::binary);
+        if (out.fail()) {
+            return io_result_mk_error((sstream() << "failed to create file '" << fn << "'").str());
+        }
+        size_t base_addr   = mk_olean_base_addr(hash_str(fn.size(), reinterpret_cast<unsigned char const *>(fn.data()), 11));
+        size_t header_size = strlen(g_olean_dictionary_header) + sizeof(base_addr) + sizeof(uint64);
+        object_compactor compactor(reinterpret_cast<void *>(base_addr + header_size));
+        compactor(data);
+        uint64 id = hash_str(compactor.size(), static_cast<unsigned char const *>(compactor.data()), 31);
+        // zero means no dictionary, see `olean_dictionary_ref`
+        if (id == 0) id = 1;
+        out.write(g_olean_dictionary_header, strlen(g_olean_dictionary_header));
+        out.write(reinterpret_cast<char *>(&base_addr), sizeof(base_addr));
+        out.write(reinterpret_cast<char *>(&id), sizeof(id));
+        out.write(static_cast<char const *>(compactor.data()), compactor.size());
+        out.close();
+        if (out.fail() || std::rename(tmp_fn.c_str(), fn.c_str()) != 0) {
+            return io_result_mk_error((sstream() << "failed to write '" << fn << "': " << strerror(errno)).str());
+        }
+        return io_result_mk_ok(box(0));
+    } catch (exception & ex) {
+        return io_result_mk_error((sstream() << "failed to write '" << fn << "': " << ex.what()).str());
+    }
+}
+
+extern "C" LEAN_EXPORT object * lean_save_module_data(b_obj_arg fname, b_obj_arg mod, b_obj_arg mdata, uint64 imports_hash, object *) {
     std::string olean_fn(string_cstr(fname));
     // we first write to a temp file and then move it to the correct path (possibly deleting an older file)
     // so that we neither expose partially-written files nor modify possibly memory-mapped files
     std::string olean_tmp_fn = olean_fn + ".tmp";
     try {
+        // objects of the dictionary can only be referenced if it is mapped at its base address
+        olean_dictionary const * dict = get_olean_dictionary();
+        if (dict && dict->m_region->data() != dict->m_region->base_addr())
+            dict = nullptr;
+        olean_header_fields fields;
+        fields.m_dict = {0, 0, 0};
+        if (dict)
+            fields.m_dict = {dict->m_id, reinterpret_cast<uint64>(dict->m_region->base_addr()), dict->m_region->size()};
+        set_githash(fields);
+        fields.m_imports_hash = imports_hash;
+#ifdef LEAN_WINDOWS
         std::ofstream out(olean_tmp_fn, std::ios_base::binary);
         if (out.fail()) {
             return io_result_mk_error((sstream() << "failed to create file '" << olean_fn << "'").str());
         }
+#else
+        // the compactor streams the compacted region to the file instead of building all of it in memory
+        int fd = open(olean_tmp_fn.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        if (fd == -1) {
+            return io_result_mk_error((sstream() << "failed to create file '" << olean_fn << "'").str());
+        }
+#endif
 
-        // Derive a base address that is uniformly distributed by deterministic, and should most likely
-        // work for `mmap` on all interesting platforms
-        // NOTE: an overlapping/non-compatible base address does not prevent the module from being imported,
-        // merely from using `mmap` for that
-
-        // Let's start with a hash of the module name. Note that while our string hash is a dubious 32-bit
-        // algorithm, the mixing of multiple `Name` parts seems to result in a nicely distributed 64-bit
+        // Derive the base address from a hash of the module name. Note that while our string hash is a dubious
+        // 32-bit algorithm, the mixing of multiple `Name` parts seems to result in a nicely distributed 64-bit
         // output
-        size_t base_addr = name(mod, true).hash();
-        // x86-64 user space is currently limited to the lower 47 bits
-        // https://en.wikipedia.org/wiki/X86-64#Virtual_address_space_details
-        // On Linux at least, the stack grows down from ~0x7fff... followed by shared libraries, so reserve
-        // a bit of space for them (0x7fff...-0x7f00... = 1TB)
-        base_addr = base_addr % 0x7f0000000000;
-        // `mmap` addresses must be page-aligned. The default (non-huge) page size on x86-64 is 4KB.
-        // `MapViewOfFileEx` addresses must be aligned to the "memory allocation granularity", which is 64KB.
-        base_addr = base_addr & ~((1LL<<16) - 1);
-
-        object_compactor compactor(reinterpret_cast<void *>(base_addr + strlen(g_olean_header) + sizeof(base_addr)));
+        size_t base_addr = mk_olean_base_addr(name(mod, true).hash());
+        fields.m_base_addr = base_addr;
+
+        size_t header_size = strlen(g_olean_header) + sizeof(fields);
+        void * region_addr = reinterpret_cast<void *>(base_addr + header_size);
+#ifdef LEAN_WINDOWS
+        object_compactor compactor(region_addr);
+        if (dict)
+            compactor.set_dictionary(*dict->m_region);
         compactor(mdata);
-        out.write(g_olean_header, strlen(g_olean_header));
-        out.write(reinterpret_cast<char *>(&base_addr), sizeof(base_addr));
+        fields.m_content_hash = compactor.content_hash();
+        std::string header = mk_olean_header(g_olean_header, fields);
+        out.write(header.data(), header.size());
         out.write(static_cast<char const *>(compactor.data()), compactor.size());
         out.close();
+#else
+        try {
+            if (olean_compression_enabled()) {
+                // the compactor compresses the region while it is flushed, the table and the header are written last
+                olean_compressor compressor(fd, strlen(g_olean_compressed_header) + sizeof(fields) + sizeof(uint64));
+                object_compactor compactor(region_addr, compressor);
+                if (dict)
+                    compactor.set_dictionary(*dict->m_region);
+                compactor(mdata);
+                compactor.finish();
+                fields.m_content_hash = compactor.content_hash();
+                compressor.finish(fields);
+            } else {
+                object_compactor compactor(region_addr, fd, header_size);
+                if (dict)
+                    compactor.set_dictionary(*dict->m_region);
+                compactor(mdata);
+                compactor.finish();
+                // the header is written last since it contains the hash of the region
+                fields.m_content_hash = compactor.content_hash();
+                std::string header = mk_olean_header(g_olean_header, fields);
+                pwrite_all(fd, header.data(), header.size(), 0);
+            }
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        if (close(fd) != 0) {
+            return io_result_mk_error((sstream() << "failed to write '" << olean_fn << "': " << strerror(errno)).str());
+        }
+#endif
         while (std::rename(olean_tmp_fn.c_str(), olean_fn.c_str()) != 0) {
 #ifdef LEAN_WINDOWS
             if (errno == EEXIST) {
@@ -116,86 +611,85 @@ extern "C" LEAN_EXPORT object * lean_read_module_data(object * fname, object *)
         in.seekg(0, in.end);
         size_t size = in.tellg();
         in.seekg(0);
-        size_t header_size = strlen(g_olean_header);
-        if (size < header_size) {
-            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        olean_header_fields fields;
+        olean_format format = read_olean_header(in, size, fields);
+        bool compressed = format == olean_format::Compressed;
+        olean_header_fields expected;
+        set_githash(expected);
+        // the version of legacy files is unknown, they are accepted until stage0 is updated
+        if (format != olean_format::Legacy && memcmp(fields.m_githash, expected.m_githash, LEAN_OLEAN_GITHASH_SZ) != 0) {
+            throw exception(sstream() << "file was written by a different Lean version (" << get_githash(fields)
+                            << "), expected " << get_githash(expected));
         }
-        char * header = new char[header_size];
-        in.read(header, header_size);
-        if (strncmp(header, g_olean_header, header_size) != 0) {
-            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "', invalid header").str());
+        char * base_addr = reinterpret_cast<char *>(fields.m_base_addr);
+        olean_dictionary_ref const & dict_ref = fields.m_dict;
+        size_t header_size = strlen(g_olean_header) +
+            (format == olean_format::Legacy ? sizeof(fields.m_base_addr) : sizeof(fields));
+        olean_dictionary const * dict = nullptr;
+        if (dict_ref.m_id != 0) {
+            dict = get_olean_dictionary();
+            if (!dict || dict->m_id != dict_ref.m_id ||
+                reinterpret_cast<uint64>(dict->m_region->base_addr()) != dict_ref.m_base_addr ||
+                dict->m_region->size() != dict_ref.m_size)
+                throw exception("file was written with a different .olean dictionary, see LEAN_OLEAN_DICTIONARY");
         }
-        delete[] header;
-        char * base_addr;
-        in.read(reinterpret_cast<char *>(&base_addr), sizeof(base_addr));
-        header_size += sizeof(base_addr);
-        char * buffer = nullptr;
-        bool is_mmap = false;
-        std::function<void()> free_data;
-#ifdef LEAN_WINDOWS
-        // `FILE_SHARE_DELETE` is necessary to allow the file to (be marked to) be deleted while in use
-        HANDLE h_olean_fn = CreateFile(olean_fn.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-        if (h_olean_fn == INVALID_HANDLE_VALUE) {
-            return io_result_mk_error((sstream() << "failed to open '" << olean_fn << "': " << GetLastError()).str());
-        }
-        HANDLE h_map = CreateFileMapping(h_olean_fn, NULL, PAGE_READONLY, 0, 0, NULL);
-        if (h_olean_fn == NULL) {
-            return io_result_mk_error((sstream() << "failed to map '" << olean_fn << "': " << GetLastError()).str());
-        }
-        buffer = static_cast<char *>(MapViewOfFileEx(h_map, FILE_MAP_READ, 0, 0, 0, base_addr));
-        free_data = [=]() {
-            if (buffer) {
-                lean_always_assert(UnmapViewOfFile(base_addr));
-            }
-            lean_always_assert(CloseHandle(h_map));
-            lean_always_assert(CloseHandle(h_olean_fn));
-        };
-#else
-        int fd = open(olean_fn.c_str(), O_RDONLY);
-        if (fd == -1) {
-            return io_result_mk_error((sstream() << "failed to open '" << olean_fn << "': " << strerror(errno)).str());
-        }
-        buffer = static_cast<char *>(mmap(base_addr, size, PROT_READ, MAP_PRIVATE, fd, 0));
-        close(fd);
-        free_data = [=]() {
-            if (buffer != MAP_FAILED) {
-                lean_always_assert(munmap(buffer, size) == 0);
-            }
-        };
-#endif
-        if (buffer == base_addr) {
-            buffer += header_size;
-            is_mmap = true;
+        // references into a dictionary that has been relocated must be relocated as well
+        bool allow_at_base = !dict || dict->m_region->data() == dict->m_region->base_addr();
+        std::unique_ptr<compacted_region> region;
+        if (compressed) {
+            region.reset(read_compressed_region(in, base_addr, header_size, size, allow_at_base));
         } else {
-            free_data();
-            buffer = static_cast<char *>(malloc(size - header_size));
-            free_data = [=]() {
-                free(buffer);
-            };
-            in.read(buffer, size - header_size);
-            if (!in) {
-                return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
-            }
+            region.reset(mk_olean_region(olean_fn, size, base_addr, header_size, allow_at_base));
+        }
+        if (format == olean_format::Legacy)
+            region->set_no_chunk_index();
+        if (dict)
+            region->set_dictionary(dict->m_region->base_addr(), dict->m_region->size(), dict->m_region->data());
+        // without `mmap`, the data is read and relocated at the same time
+        object * mod = compressed || region->is_memory_mapped() ? region->read() : region->read(in);
+        if (!mod) {
+            return io_result_mk_error((sstream() << "failed to read file '" << olean_fn << "'").str());
         }
         in.close();
-
-        compacted_region * region = new compacted_region(size - header_size, buffer, base_addr + header_size, is_mmap, free_data);
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
         // do not report as leak
-        __lsan_ignore_object(region);
+        __lsan_ignore_object(region.get());
 #endif
 #endif
-        object * mod = region->read();
         object * mod_region = alloc_cnstr(0, 2, 0);
         cnstr_set(mod_region, 0, mod);
-        cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region)));
+        cnstr_set(mod_region, 1, box_size_t(reinterpret_cast<size_t>(region.release())));
         return io_result_mk_ok(mod_region);
     } catch (exception & ex) {
         return io_result_mk_error((sstream() << "failed to read '" << olean_fn << "': " << ex.what()).str());
     }
 }
 
+/* readOleanHeader (fname : @& FilePath) : IO (Option OleanHeader) */
+extern "C" LEAN_EXPORT object * lean_read_olean_header(b_obj_arg fname, object *) {
+    std::string olean_fn(string_cstr(fname));
+    try {
+        std::ifstream in(olean_fn, std::ios_base::binary);
+        if (in.fail()) {
+            return io_result_mk_error((sstream() << "failed to open file '" << olean_fn << "'").str());
+        }
+        in.seekg(0, in.end);
+        size_t size = in.tellg();
+        in.seekg(0);
+        olean_header_fields fields;
+        if (read_olean_header(in, size, fields) == olean_format::Legacy)
+            return io_result_mk_ok(mk_option_none());
+        object * r = alloc_cnstr(0, 1, 2 * sizeof(uint64));
+        cnstr_set(r, 0, mk_string(get_githash(fields)));
+        cnstr_set_uint64(r, sizeof(object *), fields.m_content_hash);
+        cnstr_set_uint64(r, sizeof(object *) + sizeof(uint64), fields.m_imports_hash);
+        return io_result_mk_ok(mk_option_some(r));
+    } catch (exception & ex) {
+        return io_result_mk_error((sstream() << "failed to read '" << olean_fn << "': " << ex.what()).str());
+    }
+}
+
 /*
 @[export lean.write_module_core]
 def writeModule (env : Environment) (fname : String) : IO Unit := */
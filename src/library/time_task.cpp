@@ -42,7 +42,7 @@ void finalize_time_task() {
 }
 
 time_task::time_task(std::string const & category, options const & opts, name decl) :
-        m_category(category) {
+        m_category(category), m_alloc_category(m_category.c_str()) {
     if (get_profiler(opts)) {
         m_timeit = optional<xtimeit>(get_profiling_threshold(opts), [=](second_duration duration) mutable {
             sstream ss;
@@ -9,6 +9,7 @@ Author: Sebastian Ullrich
 #include "library/profiling.h"
 #include "util/timeit.h"
 #include "util/message_definitions.h"
+#include "runtime/allocprof.h"
 
 namespace lean {
 void report_profiling_time(std::string const & category, second_duration time);
@@ -19,6 +20,8 @@ class time_task {
     std::string     m_category;
     optional<xtimeit> m_timeit;
     time_task *     m_parent_task;
+    /* Attribute allocations to `m_category` in the sampling allocation profiler, even if the profiler option is off */
+    scoped_alloc_category m_alloc_category;
 public:
     time_task(std::string const & category, options const & opts, name decl = name());
     ~time_task();
@@ -5,10 +5,24 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
 #include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/debug.h"
 #include "runtime/alloc.h"
+#include "runtime/allocprof.h"
+
+#if !defined(LEAN_WINDOWS) && !defined(LEAN_EMSCRIPTEN)
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#define LEAN_MMAP_SEGMENTS
+#endif
 
 #ifdef LEAN_RUNTIME_STATS
 #define LEAN_RUNTIME_STAT_CODE(c) c
@@ -25,7 +39,10 @@ Author: Leonardo de Moura
 #define LEAN_PAGE_SIZE             8192        // 8 Kb
 #define LEAN_SEGMENT_SIZE          8*1024*1024 // 8 Mb
 #define LEAN_NUM_SLOTS             (LEAN_MAX_SMALL_OBJECT_SIZE / LEAN_OBJECT_SIZE_DELTA)
-#define LEAN_MAX_TO_EXPORT_OBJS    1024
+/* Default number of empty pages a heap keeps before returning the memory of further empty pages to the OS,
+   see `LEAN_RETAINED_EMPTY_PAGES`. */
+#define LEAN_DEFAULT_RETAINED_EMPTY_PAGES 256   // 2 Mb
+#define LEAN_HUGE_PAGE_SIZE        2*1024*1024 // 2 Mb
 
 LEAN_CASSERT(LEAN_PAGE_SIZE > LEAN_MAX_SMALL_OBJECT_SIZE);
 LEAN_CASSERT(LEAN_SEGMENT_SIZE > LEAN_PAGE_SIZE);
@@ -42,8 +59,10 @@ static atomic<uint64> g_num_dealloc(0);
 static atomic<uint64> g_num_small_dealloc(0);
 static atomic<uint64> g_num_segments(0);
 static atomic<uint64> g_num_pages(0);
-static atomic<uint64> g_num_exports(0);
+static atomic<uint64> g_num_remote_frees(0);
 static atomic<uint64> g_num_recycled_pages(0);
+static atomic<uint64> g_num_reused_pages(0);
+static atomic<uint64> g_num_decommitted_pages(0);
 struct alloc_stats {
     ~alloc_stats() {
         std::cerr << "num. alloc.:         " << g_num_alloc << "\n";
@@ -53,7 +72,9 @@ struct alloc_stats {
         std::cerr << "num. segments:       " << g_num_segments << "\n";
         std::cerr << "num. pages:          " << g_num_pages << "\n";
         std::cerr << "num. recycled pages: " << g_num_recycled_pages << "\n";
-        std::cerr << "num. exports:        " << g_num_exports << "\n";
+        std::cerr << "num. reused pages:   " << g_num_reused_pages << "\n";
+        std::cerr << "num. decomm. pages:  " << g_num_decommitted_pages << "\n";
+        std::cerr << "num. remote frees:   " << g_num_remote_frees << "\n";
     }
 };
 static alloc_stats g_alloc_stats;
@@ -66,6 +87,10 @@ struct page_header {
     page *           m_next;
     page *           m_prev;
     void *           m_free_list;
+    /* Objects of this page deallocated by threads other than the owner of `m_heap`. */
+    std::atomic<void *> m_remote_free_list;
+    /* Next page in `heap::m_remote_pages`. */
+    page *           m_next_remote;
     unsigned         m_obj_size;
     unsigned         m_max_free;
     unsigned         m_num_free;
@@ -83,6 +108,7 @@ struct page {
     void set_heap(heap * h) { m_header.m_heap = h; }
     heap * get_heap() { return m_header.m_heap; }
     bool has_many_free() const { return m_header.m_num_free > m_header.m_max_free / 4; }
+    bool is_empty() const { return m_header.m_num_free == m_header.m_max_free; }
     bool in_page_free_list() const { return m_header.m_in_page_free_list; }
     unsigned get_slot_idx() const { return m_header.m_slot_idx; }
     void push_free_obj(void * o);
@@ -117,19 +143,43 @@ struct heap {
     heap *    m_next_orphan{nullptr};
     page *    m_curr_page[LEAN_NUM_SLOTS];
     page *    m_page_free_list[LEAN_NUM_SLOTS];
-    /* Objects that must be sent to other heaps. */
-    void *    m_to_export_list{nullptr};
-    unsigned  m_to_export_list_size{0};
-    mutex     m_mutex; /* for the following fields */
-    /* The following list contains object by this heap that were deallocated
-       by other heaps. */
-    void *    m_to_import_list{nullptr};
+    /* Pages without live objects, they can be reused for any object size. Linked by `m_next`. */
+    page *    m_empty_pages{nullptr};
+    size_t    m_num_empty_pages{0};
+    /* Empty pages whose memory has been returned to the OS. Their headers are not valid anymore. */
+    std::vector<page *> m_decommitted_pages;
+    /* Pages with a nonempty `m_remote_free_list`. A page is pushed by the thread that makes its
+       remote free list nonempty, and the whole stack is taken by the owner in `collect_remote_frees`,
+       so a page is in this stack at most once. */
+    std::atomic<page *> m_remote_pages{nullptr};
+    /* NUMA node segments are bound to, or -1. */
+    int       m_numa_node{-1};
     uint64_t  m_heartbeat{0}; /* Counter for implementing "deterministic timeouts". It is currently the number of small allocations */
-    void import_objs();
-    void export_objs();
+    /* Bytes to be allocated before the next call to `alloc_sampler_trigger`. See `allocprof.h`. */
+    int64_t   m_bytes_until_sample{alloc_sampler_initial_countdown()};
+    /* Object of the pending allocation sample of the thread, see `alloc_sampler_complete`. */
+    void *    m_sampled_obj{nullptr};
+    void collect_remote_frees();
     void alloc_segment();
+    void push_empty_page(page * p);
+    void decommit_empty_pages(size_t num_retained);
 };
 
+/* Maximal number of empty pages per heap before we start returning memory to the OS.
+   Set with the environment variable `LEAN_RETAINED_EMPTY_PAGES`; a negative value disables decommitting. */
+static size_t g_max_retained_empty_pages = LEAN_DEFAULT_RETAINED_EMPTY_PAGES;
+static bool g_decommit_supported = false;
+
+/* Backing of segments, set with the environment variable `LEAN_HUGE_PAGES`. With `transparent`, segments are
+   aligned to huge page boundaries and the kernel is asked to back them with transparent huge pages. With `explicit`,
+   segments are taken from the preallocated pool of 2 Mb huge pages (`vm.nr_hugepages`), falling back to transparent
+   huge pages when the pool is exhausted. Returning an 8 Kb page to the OS would split a huge page, so empty pages
+   are not decommitted in these modes. */
+enum class huge_pages_mode { None, Transparent, Explicit };
+static huge_pages_mode g_huge_pages = huge_pages_mode::None;
+/* Bytes of small object pages currently backed by memory, plus bytes of live big objects. */
+static std::atomic<size_t> g_committed_bytes(0);
+
 struct heap_manager {
     /* The mutex protects the list of orphan segments. */
     mutex             m_mutex;
@@ -142,12 +192,17 @@ struct heap_manager {
         m_orphans = h;
     }
 
-    heap * pop_orphan() {
+    /* Prefer a heap whose segments are bound to `numa_node`. */
+    heap * pop_orphan(int numa_node) {
         /* TODO(Leo): avoid mutex */
         lock_guard<mutex> lock(m_mutex);
-        if (m_orphans) {
-            heap * h = m_orphans;
-            m_orphans = h->m_next_orphan;
+        heap ** it = &m_orphans;
+        while (*it && (*it)->m_numa_node != numa_node)
+            it = &(*it)->m_next_orphan;
+        if (*it == nullptr)
+            it = &m_orphans;
+        if (heap * h = *it) {
+            *it = h->m_next_orphan;
             return h;
         } else {
             return nullptr;
@@ -180,8 +235,9 @@ static inline void page_list_insert(page * & head, page * new_head) {
 
 static inline void page_list_remove(page * & head, page * to_remove) {
     if (head == to_remove) {
-        /* First element */
+        /* First element, its `prev` field is not meaningful */
         head = to_remove->get_next();
+        return;
     }
     page * prev = to_remove->get_prev();
     lean_assert(prev);
@@ -216,75 +272,189 @@ void page::push_free_obj(void * o) {
             page_list_insert(h->m_page_free_list[slot_idx], this);
         }
     }
+    if (in_page_free_list() && is_empty()) {
+        /* The page can be reused for a different object size. */
+        heap * h = get_heap();
+        page_list_remove(h->m_page_free_list[m_header.m_slot_idx], this);
+        m_header.m_in_page_free_list = false;
+        h->push_empty_page(this);
+    }
 }
 
-void heap::import_objs() {
-    void * to_import = nullptr;
-    {   // TODO(Leo): avoid mutex using compare and swap
-        lock_guard<mutex> lock(m_mutex);
-        to_import = m_to_import_list;
-        m_to_import_list = nullptr;
+static void decommit(char * mem, size_t sz) {
+#if defined(LEAN_MMAP_SEGMENTS)
+#if defined(__APPLE__)
+    madvise(mem, sz, MADV_FREE);
+#else
+    madvise(mem, sz, MADV_DONTNEED);
+#endif
+#else
+    (void)mem; (void)sz;
+#endif
+}
+
+void heap::push_empty_page(page * p) {
+    p->set_next(m_empty_pages);
+    m_empty_pages = p;
+    m_num_empty_pages++;
+    /* Decommit in batches so that adjacent pages can be coalesced into a single system call. */
+    if (g_decommit_supported && m_num_empty_pages > 2 * g_max_retained_empty_pages)
+        decommit_empty_pages(g_max_retained_empty_pages);
+}
+
+/* Return the memory of all but the `num_retained` most recently emptied pages to the OS. */
+void heap::decommit_empty_pages(size_t num_retained) {
+    if (!g_decommit_supported || m_num_empty_pages <= num_retained)
+        return;
+    page ** it = &m_empty_pages;
+    for (size_t i = 0; i < num_retained; i++)
+        it = &(*it)->m_header.m_next;
+    page * to_decommit = *it;
+    *it = nullptr;
+    size_t first = m_decommitted_pages.size();
+    while (to_decommit) {
+        m_decommitted_pages.push_back(to_decommit);
+        to_decommit = to_decommit->get_next();
     }
-    while (to_import) {
-        page * p = get_page_of(to_import);
-        void * n = get_next_obj(to_import);
-        p->push_free_obj(to_import);
-        to_import = n;
+    m_num_empty_pages = num_retained;
+    std::sort(m_decommitted_pages.begin() + first, m_decommitted_pages.end());
+    size_t i = first;
+    while (i < m_decommitted_pages.size()) {
+        char * begin = reinterpret_cast<char *>(m_decommitted_pages[i]);
+        size_t j = i + 1;
+        while (j < m_decommitted_pages.size() &&
+               reinterpret_cast<char *>(m_decommitted_pages[j]) == begin + (j - i) * LEAN_PAGE_SIZE)
+            j++;
+        decommit(begin, (j - i) * LEAN_PAGE_SIZE);
+        i = j;
     }
+    size_t n = m_decommitted_pages.size() - first;
+    LEAN_RUNTIME_STAT_CODE(g_num_decommitted_pages += n);
+    g_committed_bytes -= n * LEAN_PAGE_SIZE;
 }
 
-struct export_entry {
-    heap * m_heap;
-    void * m_head;
-    void * m_tail;
-};
+/* Deallocate `o` from a thread that does not own the heap of its page. */
+static void push_remote_free_obj(page * p, void * o) {
+    LEAN_RUNTIME_STAT_CODE(g_num_remote_frees++);
+    void * head = p->m_header.m_remote_free_list.load(std::memory_order_relaxed);
+    do {
+        set_next_obj(o, head);
+    } while (!p->m_header.m_remote_free_list.compare_exchange_weak(head, o, std::memory_order_release, std::memory_order_relaxed));
+    if (head == nullptr) {
+        /* We made the remote free list nonempty, notify the owner. */
+        heap * h = p->get_heap();
+        page * top = h->m_remote_pages.load(std::memory_order_relaxed);
+        do {
+            p->m_header.m_next_remote = top;
+        } while (!h->m_remote_pages.compare_exchange_weak(top, p, std::memory_order_release, std::memory_order_relaxed));
+    }
+}
 
-void heap::export_objs() {
-    std::vector<export_entry> to_export;
-    void * o = m_to_export_list;
-    while (o != nullptr) {
-        void * n   = get_next_obj(o);
-        heap * h   = get_page_of(o)->get_heap();
-        bool found = false;
-        for (export_entry & e : to_export) {
-            if (e.m_heap == h) {
-                set_next_obj(o, e.m_head);
-                e.m_head = o;
-                found = true;
-                break;
-            }
+void heap::collect_remote_frees() {
+    page * p = m_remote_pages.exchange(nullptr, std::memory_order_acquire);
+    while (p) {
+        /* Read the link before emptying the remote free list; afterwards another thread may push `p` again. */
+        page * next = p->m_header.m_next_remote;
+        void * o = p->m_header.m_remote_free_list.exchange(nullptr, std::memory_order_acquire);
+        while (o) {
+            void * n = get_next_obj(o);
+            p->push_free_obj(o);
+            o = n;
         }
-        if (!found) {
-            set_next_obj(o, nullptr);
-            to_export.push_back(export_entry{h, o, o});
-        }
-        o = n;
+        p = next;
     }
-    m_to_export_list      = nullptr;
-    m_to_export_list_size = 0;
-    for (export_entry const & e : to_export) {
-        unique_lock<mutex> lock(e.m_heap->m_mutex);
-        set_next_obj(e.m_tail, e.m_heap->m_to_import_list);
-        e.m_heap->m_to_import_list = e.m_head;
+}
+
+#if defined(LEAN_MMAP_SEGMENTS)
+#if defined(__linux__)
+#define LEAN_MPOL_PREFERRED 1
+/* Make the kernel allocate the memory of the given range on `numa_node` when it is first touched. */
+static void bind_to_numa_node(void * mem, size_t sz, int numa_node) {
+    if (numa_node < 0 || numa_node >= static_cast<int>(8 * sizeof(unsigned long)))
+        return;
+    unsigned long mask = 1ul << numa_node;
+    syscall(SYS_mbind, mem, sz, LEAN_MPOL_PREFERRED, &mask, 8 * sizeof(unsigned long), 0);
+}
+#else
+static void bind_to_numa_node(void *, size_t, int) {}
+#endif
+
+static size_t segment_mapping_size() {
+    if (g_huge_pages == huge_pages_mode::None)
+        return sizeof(segment);
+    else
+        return lean_align(sizeof(segment), LEAN_HUGE_PAGE_SIZE);
+}
+
+static void * map_segment_memory(int numa_node) {
+    size_t sz = segment_mapping_size();
+    void * mem = MAP_FAILED;
+    if (g_huge_pages == huge_pages_mode::None) {
+        mem = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) lean_internal_panic_out_of_memory();
+    } else {
+#if defined(MAP_HUGETLB)
+        if (g_huge_pages == huge_pages_mode::Explicit)
+            mem = mmap(nullptr, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (mem == MAP_FAILED) {
+            /* Over-allocate and trim so that the segment starts at a huge page boundary. */
+            char * raw = static_cast<char *>(mmap(nullptr, sz + LEAN_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+            if (raw == MAP_FAILED) lean_internal_panic_out_of_memory();
+            char * aligned = align_ptr(raw, LEAN_HUGE_PAGE_SIZE);
+            if (aligned != raw)
+                munmap(raw, aligned - raw);
+            munmap(aligned + sz, (raw + sz + LEAN_HUGE_PAGE_SIZE) - (aligned + sz));
+            mem = aligned;
+#if defined(MADV_HUGEPAGE)
+            madvise(mem, sz, MADV_HUGEPAGE);
+#endif
+        }
     }
+    bind_to_numa_node(mem, sz, numa_node);
+    return mem;
 }
+#endif
 
 void heap::alloc_segment() {
     LEAN_RUNTIME_STAT_CODE(g_num_segments++);
+#if defined(LEAN_MMAP_SEGMENTS)
+    /* Map segments directly so that their pages are committed lazily and can be decommitted. */
+    segment * s = new (map_segment_memory(m_numa_node)) segment();
+#else
     segment * s = new segment();
+#endif
     s->m_next   = m_curr_segment;
     m_curr_segment = s;
 }
 
 static page * alloc_page(heap * h, unsigned obj_size) {
     lean_assert(lean_align(obj_size, LEAN_OBJECT_SIZE_DELTA) == obj_size);
-    segment * s = h->m_curr_segment;
-    LEAN_RUNTIME_STAT_CODE(g_num_pages++);
-    page * p    = new (s->m_next_page_mem) page();
-    s->m_next_page_mem += LEAN_PAGE_SIZE;
-    if (s->is_full()) {
-        /* s is full, we need to allocate a new one. */
-        h->alloc_segment();
+    page * p;
+    if (h->m_empty_pages) {
+        /* reuse a page that was emptied, possibly by other threads, for any object size */
+        LEAN_RUNTIME_STAT_CODE(g_num_reused_pages++);
+        p = h->m_empty_pages;
+        h->m_empty_pages = p->get_next();
+        h->m_num_empty_pages--;
+        lean_assert(p->m_header.m_remote_free_list.load() == nullptr);
+        p->set_prev(nullptr);
+    } else if (!h->m_decommitted_pages.empty()) {
+        LEAN_RUNTIME_STAT_CODE(g_num_reused_pages++);
+        p = new (h->m_decommitted_pages.back()) page();
+        h->m_decommitted_pages.pop_back();
+        g_committed_bytes += LEAN_PAGE_SIZE;
+    } else {
+        segment * s = h->m_curr_segment;
+        LEAN_RUNTIME_STAT_CODE(g_num_pages++);
+        g_committed_bytes += LEAN_PAGE_SIZE;
+        p = new (s->m_next_page_mem) page();
+        s->m_next_page_mem += LEAN_PAGE_SIZE;
+        if (s->is_full()) {
+            /* s is full, we need to allocate a new one. */
+            h->alloc_segment();
+        }
     }
     unsigned slot_idx        = lean_get_slot_idx(obj_size);
     p->m_header.m_heap       = h;
@@ -323,19 +493,24 @@ static page * alloc_page(heap * h, unsigned obj_size) {
 
 static void finalize_heap(void * _h) {
     heap * h = static_cast<heap*>(_h);
-    h->export_objs();
-    h->import_objs();
+    /* The pending allocation sample is recorded by the finalizer of the sampler. */
+    h->m_sampled_obj = nullptr;
+    h->collect_remote_frees();
+    /* The heap may not be reused for a long time. */
+    h->decommit_empty_pages(0);
     g_heap_manager->push_orphan(h);
 }
 
 LEAN_NOINLINE
 static void init_heap(bool main) {
     lean_assert(g_heap == nullptr);
-    if (heap * h = g_heap_manager->pop_orphan()) {
+    int numa_node = numa_current_node();
+    if (heap * h = g_heap_manager->pop_orphan(numa_node)) {
         /* reuse orphan heap */
         g_heap = h;
     } else {
         g_heap = new heap();
+        g_heap->m_numa_node = numa_node;
         g_curr_pages = g_heap->m_curr_page;
         for (unsigned i = 0; i < LEAN_NUM_SLOTS; i++) {
             g_heap->m_curr_page[i] = nullptr;
@@ -360,14 +535,28 @@ void init_thread_heap() {
     init_heap(false);
 }
 
+void bind_thread_heap_to_numa_node(unsigned numa_node) {
+    if (!g_heap || g_heap->m_numa_node == static_cast<int>(numa_node))
+        return;
+    g_heap->m_numa_node = numa_node;
+#if defined(LEAN_MMAP_SEGMENTS)
+    /* Only affects pages that have not been touched yet, which are most pages of a new heap. */
+    for (segment * s = g_heap->m_curr_segment; s; s = s->m_next)
+        bind_to_numa_node(s, segment_mapping_size(), numa_node);
+#endif
+}
+
 LEAN_NOINLINE
 void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
     if (g_heap->m_page_free_list[slot_idx] == nullptr) {
-        g_heap->import_objs();
+        g_heap->collect_remote_frees();
         lean_assert(g_heap->m_curr_page[slot_idx] == p);
-        /* g_heap->import_objs() may add objects to p->m_header.m_free_list */
-        if (p->m_header.m_free_list == nullptr)
-            p = alloc_page(g_heap, sz);
+    }
+    /* g_heap->collect_remote_frees() may add objects to p->m_header.m_free_list or pages to g_heap->m_page_free_list */
+    if (p->m_header.m_free_list != nullptr) {
+        /* use current page */
+    } else if (g_heap->m_page_free_list[slot_idx] == nullptr) {
+        p = alloc_page(g_heap, sz);
     } else {
         p = page_list_pop(g_heap->m_page_free_list[slot_idx]);
         p->m_header.m_in_page_free_list = false;
@@ -381,16 +570,32 @@ void * lean_alloc_small_cold(unsigned sz, unsigned slot_idx, page * p) {
     return r;
 }
 
+LEAN_NOINLINE
+static void complete_alloc_sample_core() {
+    g_heap->m_sampled_obj = nullptr;
+    alloc_sampler_complete();
+}
+
+LEAN_NOINLINE
+static void sample_alloc(void * o, size_t sz) {
+    if (g_heap->m_sampled_obj)
+        complete_alloc_sample_core();
+    g_heap->m_bytes_until_sample = alloc_sampler_trigger(o, sz, g_heap->m_sampled_obj);
+}
+
 extern "C" LEAN_EXPORT void * lean_alloc_small(unsigned sz, unsigned slot_idx) {
     page * p = g_heap->m_curr_page[slot_idx];
     g_heap->m_heartbeat++;
     void * r = p->m_header.m_free_list;
     if (LEAN_UNLIKELY(r == nullptr)) {
-        return lean_alloc_small_cold(sz, slot_idx, p);
+        r = lean_alloc_small_cold(sz, slot_idx, p);
+    } else {
+        p->m_header.m_free_list = get_next_obj(r);
+        p->m_header.m_num_free--;
+        lean_assert(get_page_of(r) == p);
     }
-    p->m_header.m_free_list = get_next_obj(r);
-    p->m_header.m_num_free--;
-    lean_assert(get_page_of(r) == p);
+    if (LEAN_UNLIKELY((g_heap->m_bytes_until_sample -= sz) < 0))
+        sample_alloc(r, sz);
     return r;
 }
 
@@ -400,6 +605,9 @@ void * alloc(size_t sz) {
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
         void * r = malloc(sz);
         if (r == nullptr) lean_internal_panic_out_of_memory();
+        g_committed_bytes.fetch_add(sz, std::memory_order_relaxed);
+        if (g_heap && LEAN_UNLIKELY((g_heap->m_bytes_until_sample -= sz) < 0))
+            sample_alloc(r, sz);
         return r;
     }
     lean_assert(g_heap);
@@ -410,13 +618,7 @@ void * alloc(size_t sz) {
 
 LEAN_NOINLINE
 static void dealloc_small_core_cold(void * o) {
-    set_next_obj(o, g_heap->m_to_export_list);
-    g_heap->m_to_export_list = o;
-    g_heap->m_to_export_list_size++;
-    if (g_heap->m_to_export_list_size > LEAN_MAX_TO_EXPORT_OBJS) {
-        LEAN_RUNTIME_STAT_CODE(g_num_exports++);
-        g_heap->export_objs();
-    }
+    push_remote_free_obj(get_page_of(o), o);
 }
 
 static inline void dealloc_small_core(void * o) {
@@ -425,6 +627,8 @@ static inline void dealloc_small_core(void * o) {
         init_heap(false);
     }
     lean_assert(g_heap);
+    if (LEAN_UNLIKELY(o == g_heap->m_sampled_obj))
+        complete_alloc_sample_core();
     page * p = get_page_of(o);
     if (LEAN_LIKELY(p->get_heap() == g_heap)) {
         p->push_free_obj(o);
@@ -437,6 +641,9 @@ void dealloc(void * o, size_t sz) {
     LEAN_RUNTIME_STAT_CODE(g_num_dealloc++);
     sz = lean_align(sz, LEAN_OBJECT_SIZE_DELTA);
     if (LEAN_UNLIKELY(sz > LEAN_MAX_SMALL_OBJECT_SIZE)) {
+        g_committed_bytes.fetch_sub(sz, std::memory_order_relaxed);
+        if (g_heap && LEAN_UNLIKELY(o == g_heap->m_sampled_obj))
+            complete_alloc_sample_core();
         return free(o);
     }
     dealloc_small_core(o);
@@ -455,6 +662,27 @@ extern "C" LEAN_EXPORT unsigned lean_small_mem_size(void * o) {
 
 void initialize_alloc() {
 #ifdef LEAN_SMALL_ALLOCATOR
+#if defined(LEAN_MMAP_SEGMENTS)
+    long os_page_size = sysconf(_SC_PAGESIZE);
+    g_decommit_supported = os_page_size > 0 && LEAN_PAGE_SIZE % os_page_size == 0;
+    if (char const * n = std::getenv("LEAN_RETAINED_EMPTY_PAGES")) {
+        long v = atol(n);
+        if (v < 0)
+            g_decommit_supported = false;
+        else
+            g_max_retained_empty_pages = v;
+    }
+    if (char const * m = std::getenv("LEAN_HUGE_PAGES")) {
+        std::string mode(m);
+        if (mode == "transparent")
+            g_huge_pages = huge_pages_mode::Transparent;
+        else if (mode == "explicit")
+            g_huge_pages = huge_pages_mode::Explicit;
+        if (g_huge_pages != huge_pages_mode::None)
+            g_decommit_supported = false;
+    }
+#endif
+    initialize_alloc_sampler();
     g_heap_manager = new heap_manager();
     init_heap(true);
 #endif
@@ -477,6 +705,21 @@ extern "C" LEAN_EXPORT void lean_inc_heartbeat() {
 #endif
 }
 
+size_t get_committed_memory() {
+#ifdef LEAN_SMALL_ALLOCATOR
+    return g_committed_bytes.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+void complete_alloc_sample() {
+#ifdef LEAN_SMALL_ALLOCATOR
+    if (g_heap && LEAN_UNLIKELY(g_heap->m_sampled_obj != nullptr))
+        complete_alloc_sample_core();
+#endif
+}
+
 uint64_t get_num_heartbeats() {
 #ifdef LEAN_SMALL_ALLOCATOR
     if (g_heap)
@@ -10,9 +10,17 @@ Author: Leonardo de Moura
 
 namespace lean {
 void init_thread_heap();
+/** \brief Bind the segments of the current thread heap to the given NUMA node, see `numa_num_nodes`. */
+void bind_thread_heap_to_numa_node(unsigned numa_node);
 void * alloc(size_t sz);
 void dealloc(void * o, size_t sz);
 uint64_t get_num_heartbeats();
+/** \brief Return the number of bytes currently committed by the small object allocator,
+    plus the size of all live big objects. Return 0 if the small object allocator is disabled. */
+size_t get_committed_memory();
+/** \brief Record the pending allocation sample of the current thread, see `alloc_sampler_complete`. Must be called
+    before objects allocated by the current thread can be freed by other threads. */
+void complete_alloc_sample();
 void initialize_alloc();
 void finalize_alloc();
 }
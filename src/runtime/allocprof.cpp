@@ -4,7 +4,27 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
+#include <vector>
+#include <string>
+#include <map>
+#include <tuple>
+#include <cstdlib>
+#include <cmath>
+#include <atomic>
+#include <fstream>
+#include <iostream>
 #include "runtime/allocprof.h"
+#include "runtime/thread.h"
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#endif
+
+#define LEAN_DEFAULT_ALLOC_PROFILE_RATE (512*1024)
+#define LEAN_ALLOC_PROFILE_MAX_DEPTH    64
+
 namespace lean {
 allocprof::allocprof(std::ostream & out, char const * msg):
     m_out(out), m_msg(msg) {
@@ -44,4 +64,286 @@ allocprof::~allocprof() {
     m_out << "Allocation profiling data is not available, compile lean using `-D RUNTIME_STATS=ON`\n";
 #endif
 }
+
+/* Samples are aggregated by stack, size, kind and category. */
+typedef std::tuple<std::vector<void *>, size_t, std::string, std::string> alloc_sample_key;
+
+static std::string *                          g_alloc_profile_file = nullptr;
+static int64_t                                g_alloc_profile_rate = 0;
+static mutex *                                g_alloc_samples_mutex = nullptr;
+static std::map<alloc_sample_key, uint64_t> * g_alloc_samples = nullptr;
+
+LEAN_THREAD_VALUE(char const *, g_alloc_category, nullptr);
+
+/* Sampler state of a thread. The kind of a sampled object is only known after its header has been initialized by
+   the caller of the allocator, so the sample stays pending until `alloc_sampler_complete`. */
+struct alloc_sampler {
+    void *       m_obj{nullptr};
+    size_t       m_size{0};
+    /* Copy of `g_alloc_category`, which may be freed before the sample is completed */
+    std::string  m_category;
+    void *       m_stack[LEAN_ALLOC_PROFILE_MAX_DEPTH];
+    int          m_depth{0};
+    /* Whether the allocator calls `alloc_sampler_trigger` on the next allocation to start `m_countdown` */
+    bool         m_resume{false};
+    int64_t      m_countdown{0};
+    /* State of the xorshift generator of the sampling periods */
+    uint64_t     m_random;
+};
+LEAN_THREAD_PTR(alloc_sampler, g_alloc_sampler);
+
+scoped_alloc_category::scoped_alloc_category(char const * category):m_old(g_alloc_category) {
+    g_alloc_category = category;
+}
+
+scoped_alloc_category::~scoped_alloc_category() {
+    g_alloc_category = m_old;
+}
+
+static char const * object_kind_name(void * o) {
+    /* Best effort, `o` may not be a Lean object (e.g. `mpz` digits) */
+    unsigned tag = lean_ptr_tag(static_cast<lean_object *>(o));
+    if (tag <= LeanMaxCtorTag) return "ctor";
+    switch (tag) {
+    case LeanClosure:     return "closure";
+    case LeanArray:       return "array";
+    case LeanStructArray: return "struct_array";
+    case LeanScalarArray: return "scalar_array";
+    case LeanString:      return "string";
+    case LeanMPZ:         return "mpz";
+    case LeanThunk:       return "thunk";
+    case LeanTask:        return "task";
+    case LeanRef:         return "ref";
+    case LeanExternal:    return "external";
+    default:              return "unknown";
+    }
+}
+
+static void record_pending_sample(alloc_sampler & s) {
+    alloc_sample_key key(std::vector<void *>(s.m_stack, s.m_stack + s.m_depth), s.m_size,
+                         object_kind_name(s.m_obj), s.m_category);
+    s.m_obj = nullptr;
+    lock_guard<mutex> lock(*g_alloc_samples_mutex);
+    (*g_alloc_samples)[key]++;
+}
+
+static void finalize_alloc_sampler(void * p) {
+    alloc_sampler * s = static_cast<alloc_sampler *>(p);
+    if (s->m_obj)
+        record_pending_sample(*s);
+    delete s;
+    g_alloc_sampler = nullptr;
+}
+
+static std::atomic<uint64_t> g_alloc_sampler_seed(0x9e3779b97f4a7c15ull);
+
+static uint64_t mk_random_state() {
+    return g_alloc_sampler_seed.fetch_add(0x9e3779b97f4a7c15ull, std::memory_order_relaxed) | 1;
+}
+
+static alloc_sampler & get_alloc_sampler() {
+    if (!g_alloc_sampler) {
+        g_alloc_sampler = new alloc_sampler();
+        g_alloc_sampler->m_random = mk_random_state();
+        register_thread_finalizer(finalize_alloc_sampler, g_alloc_sampler);
+    }
+    return *g_alloc_sampler;
+}
+
+/* Number of bytes until the next sample, exponentially distributed with mean `g_alloc_profile_rate`. Thus each
+   allocated byte starts a sample with the same probability, independently of the others. */
+static int64_t next_sample_period(uint64_t & random) {
+    random ^= random >> 12; random ^= random << 25; random ^= random >> 27;
+    // uniform in (0, 1]
+    double u = static_cast<double>(((random * 0x2545f4914f6cdd1dull) >> 11) + 1) / static_cast<double>(1ull << 53);
+    return static_cast<int64_t>(-std::log(u) * static_cast<double>(g_alloc_profile_rate));
+}
+
+int64_t alloc_sampler_initial_countdown() {
+    if (g_alloc_profile_rate == 0)
+        return INT64_MAX;
+    uint64_t random = mk_random_state();
+    return next_sample_period(random);
+}
+
+int64_t alloc_sampler_trigger(void * o, size_t sz, void * & sampled) {
+    sampled = nullptr;
+    if (g_alloc_profile_rate == 0)
+        return INT64_MAX;
+    alloc_sampler & s = get_alloc_sampler();
+    lean_assert(!s.m_obj);
+    if (s.m_resume) {
+        /* The previous sample has been completed, start counting down to the next one. */
+        s.m_resume = false;
+        int64_t countdown = s.m_countdown - static_cast<int64_t>(sz);
+        if (countdown >= 0)
+            return countdown;
+    }
+    s.m_obj      = o;
+    s.m_size     = sz;
+    s.m_category = g_alloc_category ? g_alloc_category : "";
+#ifdef __GLIBC__
+    s.m_depth    = backtrace(s.m_stack, LEAN_ALLOC_PROFILE_MAX_DEPTH);
+#endif
+    s.m_countdown = next_sample_period(s.m_random);
+    s.m_resume    = true;
+    sampled       = o;
+    /* Make sure we are called again on the next allocation. */
+    return 0;
+}
+
+void alloc_sampler_complete() {
+    if (g_alloc_sampler && g_alloc_sampler->m_obj)
+        record_pending_sample(*g_alloc_sampler);
+}
+
+/* Minimal encoder for the pprof `profile.proto` format. */
+class proto_writer {
+    std::string m_buf;
+public:
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            m_buf.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        m_buf.push_back(static_cast<char>(v));
+    }
+    void key(unsigned field, unsigned wire_type) { varint((field << 3) | wire_type); }
+    void uint(unsigned field, uint64_t v) { key(field, 0); varint(v); }
+    void bytes(unsigned field, std::string const & v) { key(field, 2); varint(v.size()); m_buf += v; }
+    void message(unsigned field, proto_writer const & m) { bytes(field, m.m_buf); }
+    void packed(unsigned field, std::vector<uint64_t> const & vs) {
+        proto_writer m;
+        for (uint64_t v : vs) m.varint(v);
+        bytes(field, m.m_buf);
+    }
+    std::string const & str() const { return m_buf; }
+};
+
+static std::string symbol_name(void * addr, bool demangle) {
+#ifdef __GLIBC__
+    Dl_info info;
+    if (dladdr(addr, &info) && info.dli_sname) {
+        if (demangle) {
+            int status = 0;
+            char * d = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            if (d) {
+                std::string r(d);
+                free(d);
+                return r;
+            }
+        }
+        return info.dli_sname;
+    }
+#else
+    (void)demangle;
+#endif
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", addr);
+    return buf;
+}
+
+static void write_alloc_profile() {
+    std::map<std::string, uint64_t> strings;
+    std::vector<std::string> string_table;
+    auto str = [&](std::string const & s) {
+        auto it = strings.find(s);
+        if (it != strings.end()) return it->second;
+        uint64_t idx = string_table.size();
+        strings[s] = idx;
+        string_table.push_back(s);
+        return idx;
+    };
+    str("");
+    proto_writer prof;
+    proto_writer objects_type, space_type, period_type;
+    objects_type.uint(1, str("alloc_objects")); objects_type.uint(2, str("count"));
+    space_type.uint(1, str("alloc_space"));     space_type.uint(2, str("bytes"));
+    period_type.uint(1, str("space"));          period_type.uint(2, str("bytes"));
+    prof.message(1, objects_type);
+    prof.message(1, space_type);
+    std::map<void *, uint64_t> locations;
+    std::map<std::string, uint64_t> functions;
+    proto_writer locs, funs;
+    alloc_sampler_complete();
+    lock_guard<mutex> lock(*g_alloc_samples_mutex);
+    for (auto const & p : *g_alloc_samples) {
+        std::vector<void *> const & stack = std::get<0>(p.first);
+        std::vector<uint64_t> loc_ids;
+        /* skip `alloc_sampler_trigger`, `sample_alloc` and the allocator entry point */
+        for (size_t i = std::min<size_t>(3, stack.size()); i < stack.size(); i++) {
+            void * addr = stack[i];
+            auto it = locations.find(addr);
+            if (it == locations.end()) {
+                std::string sname = symbol_name(addr, false);
+                auto fit = functions.find(sname);
+                if (fit == functions.end()) {
+                    uint64_t fid = functions.size() + 1;
+                    fit = functions.insert(std::make_pair(sname, fid)).first;
+                    proto_writer f;
+                    f.uint(1, fid);
+                    f.uint(2, str(symbol_name(addr, true)));
+                    f.uint(3, str(sname));
+                    prof.message(5, f);
+                }
+                uint64_t lid = locations.size() + 1;
+                it = locations.insert(std::make_pair(addr, lid)).first;
+                proto_writer line, l;
+                line.uint(1, fit->second);
+                l.uint(1, lid);
+                l.uint(3, reinterpret_cast<uint64_t>(addr));
+                l.message(4, line);
+                prof.message(4, l);
+            }
+            loc_ids.push_back(it->second);
+        }
+        /* An allocation of `sz` bytes is sampled with probability `1 - exp(-sz / rate)`, so each sample stands
+           for the inverse of that number of allocations. */
+        size_t sz = std::get<1>(p.first);
+        double scale = 1.0 / (1.0 - std::exp(-static_cast<double>(sz) / static_cast<double>(g_alloc_profile_rate)));
+        double num_objects = static_cast<double>(p.second) * scale;
+        proto_writer sample;
+        sample.packed(1, loc_ids);
+        sample.packed(2, {static_cast<uint64_t>(num_objects + 0.5), static_cast<uint64_t>(num_objects * sz + 0.5)});
+        proto_writer size_label, kind_label, category_label;
+        size_label.uint(1, str("bytes"));
+        size_label.uint(3, std::get<1>(p.first));
+        size_label.uint(4, str("bytes"));
+        kind_label.uint(1, str("kind"));
+        kind_label.uint(2, str(std::get<2>(p.first)));
+        sample.message(3, size_label);
+        sample.message(3, kind_label);
+        if (!std::get<3>(p.first).empty()) {
+            category_label.uint(1, str("category"));
+            category_label.uint(2, str(std::get<3>(p.first)));
+            sample.message(3, category_label);
+        }
+        prof.message(2, sample);
+    }
+    for (std::string const & s : string_table)
+        prof.bytes(6, s);
+    prof.message(11, period_type);
+    prof.uint(12, g_alloc_profile_rate);
+    std::ofstream out(*g_alloc_profile_file, std::ios::binary);
+    if (!out) {
+        std::cerr << "failed to write allocation profile to '" << *g_alloc_profile_file << "'\n";
+        return;
+    }
+    out << prof.str();
+}
+
+void initialize_alloc_sampler() {
+#ifndef LEAN_EMSCRIPTEN
+    char const * fn = std::getenv("LEAN_ALLOC_PROFILE");
+    if (!fn)
+        return;
+    g_alloc_profile_file  = new std::string(fn);
+    g_alloc_profile_rate  = LEAN_DEFAULT_ALLOC_PROFILE_RATE;
+    if (char const * rate = std::getenv("LEAN_ALLOC_PROFILE_RATE"))
+        g_alloc_profile_rate = std::max<int64_t>(atoll(rate), 1);
+    g_alloc_samples_mutex = new mutex();
+    g_alloc_samples       = new std::map<alloc_sample_key, uint64_t>();
+    std::atexit(write_alloc_profile);
+#endif
+}
 }
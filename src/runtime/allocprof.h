@@ -26,4 +26,31 @@ public:
     allocprof(std::ostream & out, char const * msg);
     ~allocprof();
 };
+
+/* Sampling allocation profiler, available in all builds.
+   It is enabled by setting the environment variable `LEAN_ALLOC_PROFILE` to a file name. On average every
+   `LEAN_ALLOC_PROFILE_RATE` (default 512 Kb) allocated bytes, it records the stack, the object size and kind,
+   and the innermost `time_task` category of the allocating thread. The number of bytes between samples is
+   exponentially distributed, so that periodic allocation patterns do not bias the samples. At exit, the samples are
+   written in the pprof protobuf format (`pprof -top lean <file>`), scaled to estimates of the actual allocations. */
+void initialize_alloc_sampler();
+/* Number of bytes a new thread heap may allocate before calling `alloc_sampler_trigger`. */
+int64_t alloc_sampler_initial_countdown();
+/* Called by the allocator after allocating `o` of size `sz` when the countdown of the current thread expired.
+   Returns the new countdown, and sets `sampled` to `o` if `o` is sampled, `nullptr` otherwise. The kind of `o` is
+   only known once the caller has initialized its header, so the sample is pending until `alloc_sampler_complete`. */
+int64_t alloc_sampler_trigger(void * o, size_t sz, void * & sampled);
+/* Record the pending sample of the current thread, if any. Its object must still be alive, so the allocator calls
+   it on the next allocation of the thread, before the thread frees the object, and before objects of the thread
+   are marked as multi-threaded or persistent, which is the only way other threads can free them. The sample is
+   also recorded when the thread exits. */
+void alloc_sampler_complete();
+
+/* Set the category attributed to allocations of the current thread. */
+class scoped_alloc_category {
+    char const * m_old;
+public:
+    scoped_alloc_category(char const * category);
+    ~scoped_alloc_category();
+};
 }
@@ -4,67 +4,221 @@ Released under Apache 2.0 license as described in the file LICENSE.
 
 Author: Leonardo de Moura
 */
-#include <unordered_set>
 #include <algorithm>
 #include <string>
 #include <vector>
 #include <cstring>
+#include <istream>
+#include <memory>
 #include <lean/lean.h>
 #include "runtime/hash.h"
+#include "runtime/thread.h"
+#include "runtime/exception.h"
 #include "runtime/compact.h"
 
 #ifndef LEAN_WINDOWS
 #include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
 #endif
 
 #define LEAN_COMPACTOR_INIT_SZ 1024*1024
 #define LEAN_MAX_SHARING_TABLE_INITIAL_SIZE 1024*1024
+// size of the buffer at which a compactor writing to a file starts flushing instead of growing it
+#define LEAN_COMPACTOR_STREAM_BUFFER_SZ 64*1024*1024
+// minimal size of the chunks of a compacted region that are relocated independently
+#define LEAN_COMPACTOR_CHUNK_SZ 256*1024
+// maximal number of threads relocating the chunks of a single region
+#define LEAN_MAX_RELOCATION_THREADS 8
 
 // uncomment to track the number of each kind of object in an .olean file
 // #define LEAN_TAG_COUNTERS
 
 namespace lean {
 
-struct max_sharing_key {
+/* An object of the region, identified by its contents for max sharing. The hash of the contents is stored in
+   the table, since the object may have been flushed to the file by the time the table is resized. */
+struct object_compactor::max_sharing_key {
     size_t m_offset;
     size_t m_size;
-    max_sharing_key(size_t offset, size_t sz):m_offset(offset), m_size(sz) {}
 };
 
-struct max_sharing_hash {
-    object_compactor * m;
-    max_sharing_hash(object_compactor * manager):m(manager) {}
-    unsigned operator()(max_sharing_key const & k) const {
-        return hash_str(k.m_size, reinterpret_cast<unsigned char const *>(m->m_begin) + k.m_offset, 17);
+/* Mix the bits of `h`, the tables use its lowest and highest bits */
+static inline size_t mix_hash(size_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+object_compactor::object_compactor(void * base_addr):
+    object_compactor(base_addr, -1, 0) {
+}
+
+object_compactor::object_compactor(void * base_addr, int fd, size_t fd_offset):
+    m_obj_table(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE),
+    m_max_sharing_table(new flat_hash_table<max_sharing_key>(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE)),
+    m_base_addr(base_addr),
+    m_fd(fd),
+    m_sink(nullptr),
+    m_fd_offset(fd_offset),
+    m_flushed(0),
+    m_flushed_map(nullptr),
+    m_flushed_map_sz(0),
+    m_flushed_map_failed(false),
+    m_hash(11),
+    m_root(nullptr),
+    m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
+    m_end(m_begin),
+    m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ) {
+#ifdef LEAN_WINDOWS
+    lean_always_assert(fd == -1);
+#endif
+}
+
+object_compactor::object_compactor(void * base_addr, compactor_sink & sink):
+    object_compactor(base_addr) {
+    m_sink = &sink;
+}
+
+#ifndef LEAN_WINDOWS
+static void write_region_data(int fd, char const * data, size_t sz, size_t offset) {
+    while (sz > 0) {
+        ssize_t n = pwrite(fd, data, sz, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw exception(std::string("failed to write compacted region: ") + strerror(errno));
+        }
+        data += n; sz -= n; offset += n;
     }
-};
+}
 
-struct max_sharing_eq {
-    object_compactor * m;
-    max_sharing_eq(object_compactor * manager):m(manager) {}
-    bool operator()(max_sharing_key const & k1, max_sharing_key const & k2) const {
-        if (k1.m_size != k2.m_size) return false;
-        return memcmp(reinterpret_cast<char*>(m->m_begin) + k1.m_offset, reinterpret_cast<char*>(m->m_begin) + k2.m_offset, k1.m_size) == 0;
+static void read_region_data(int fd, char * data, size_t sz, size_t offset) {
+    while (sz > 0) {
+        ssize_t n = pread(fd, data, sz, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            throw exception(std::string("failed to read back compacted region: ") + (n < 0 ? strerror(errno) : "unexpected end of file"));
+        }
+        data += n; sz -= n; offset += n;
     }
-};
+}
+#endif
+
+/* Add the region data `[offset, offset + sz)` at `data` to the hash `h`. The data is hashed word by word, so the hash
+   does not depend on how the region is split into calls. The root is skipped since it is written last. */
+static uint64 hash_region_data(uint64 h, size_t offset, char const * data, size_t sz) {
+    if (offset < sizeof(object_offset)) {
+        size_t skip = std::min(sz, sizeof(object_offset) - offset);
+        data += skip;
+        sz   -= skip;
+    }
+    lean_assert(sz % sizeof(size_t) == 0);
+    for (size_t i = 0; i < sz; i += sizeof(size_t)) {
+        size_t w;
+        memcpy(&w, data + i, sizeof(size_t));
+        h ^= static_cast<uint64>(w) * 0x87c37b91114253d5ull;
+        h  = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937full;
+    }
+    return h;
+}
 
+uint64 object_compactor::content_hash() const {
+    uint64 h = hash_region_data(m_hash, m_flushed, static_cast<char const *>(m_begin), buffered());
+    return hash(h, reinterpret_cast<uint64>(m_root));
+}
 
-struct object_compactor::max_sharing_table {
-    std::unordered_set<max_sharing_key, max_sharing_hash, max_sharing_eq> m_table;
-    max_sharing_table(object_compactor * manager):
-        m_table(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE, max_sharing_hash(manager), max_sharing_eq(manager)) {
+/* Write the first `n` bytes of the buffer to the file or sink, and remove them from the buffer. */
+void object_compactor::flush(size_t n) {
+    lean_assert(is_streaming() && n <= buffered());
+    m_hash = hash_region_data(m_hash, m_flushed, static_cast<char const *>(m_begin), n);
+    if (m_sink) {
+        m_sink->write(m_flushed, static_cast<char *>(m_begin), n);
+    } else {
+#ifndef LEAN_WINDOWS
+        write_region_data(m_fd, static_cast<char *>(m_begin), n, m_fd_offset + m_flushed);
+#else
+        lean_unreachable();
+#endif
     }
-};
+    memmove(m_begin, static_cast<char *>(m_begin) + n, buffered() - n);
+    m_end      = static_cast<char *>(m_end) - n;
+    m_flushed += n;
+}
 
-object_compactor::object_compactor(void * base_addr):
-    m_max_sharing_table(new max_sharing_table(this)),
-    m_base_addr(base_addr),
-    m_begin(malloc(LEAN_COMPACTOR_INIT_SZ)),
-    m_end(m_begin),
-    m_capacity(static_cast<char*>(m_begin) + LEAN_COMPACTOR_INIT_SZ) {
+/* Return the flushed region data mapped at least up to the region offset `end`, or `nullptr` if the file cannot be
+   mapped. The mapping grows geometrically, so it is only replaced a logarithmic number of times. */
+char const * object_compactor::map_flushed(size_t end) {
+#ifndef LEAN_WINDOWS
+    static size_t page_sz = sysconf(_SC_PAGESIZE);
+    size_t delta = m_fd_offset % page_sz;
+    if (m_flushed_map && delta + end <= m_flushed_map_sz)
+        return m_flushed_map + delta;
+    if (m_flushed_map_failed)
+        return nullptr;
+    if (m_flushed_map)
+        munmap(m_flushed_map, m_flushed_map_sz);
+    size_t sz = std::max(delta + end, 2 * m_flushed_map_sz);
+    sz = (sz + page_sz - 1) / page_sz * page_sz;
+    void * p = mmap(nullptr, sz, PROT_READ, MAP_SHARED, m_fd, m_fd_offset - delta);
+    if (p == MAP_FAILED) {
+        // fall back to reading the data back with `pread`
+        m_flushed_map        = nullptr;
+        m_flushed_map_sz     = 0;
+        m_flushed_map_failed = true;
+        return nullptr;
+    }
+    m_flushed_map    = static_cast<char *>(p);
+    m_flushed_map_sz = sz;
+    return m_flushed_map + delta;
+#else
+    (void)end;
+    lean_unreachable();
+#endif
+}
+
+/* Return the region data `[offset, offset + sz)`. Flushed data is read back from the sink, or from the file through
+   `map_flushed`. */
+char const * object_compactor::region_data(size_t offset, size_t sz) {
+    if (offset >= m_flushed)
+        return static_cast<char *>(m_begin) + (offset - m_flushed);
+    size_t n = std::min(sz, m_flushed - offset);
+    // the flushed data `[offset, offset + n)`, if it is available in memory
+    char const * flushed = nullptr;
+    if (m_sink) {
+        flushed = m_sink->read(offset, n);
+    } else {
+#ifndef LEAN_WINDOWS
+        if (char const * map = map_flushed(offset + n))
+            flushed = map + offset;
+#else
+        lean_unreachable();
+#endif
+    }
+    if (flushed && n == sz)
+        return flushed;
+    m_scratch.resize(sz);
+    if (flushed) {
+        memcpy(m_scratch.data(), flushed, n);
+    } else {
+#ifndef LEAN_WINDOWS
+        read_region_data(m_fd, m_scratch.data(), n, m_fd_offset + offset);
+#endif
+    }
+    // the object may span the flushed data and the buffer
+    memcpy(m_scratch.data() + n, m_begin, sz - n);
+    return m_scratch.data();
+}
+
+void object_compactor::finish() {
+    flush(buffered());
 }
 
 object_compactor::~object_compactor() {
+#ifndef LEAN_WINDOWS
+    if (m_flushed_map)
+        munmap(m_flushed_map, m_flushed_map_sz);
+#endif
     free(m_begin);
 }
 
@@ -80,10 +234,15 @@ void * object_compactor::alloc(size_t sz) {
     if (rem != 0)
         sz = sz + sizeof(void*) - rem;
     while (static_cast<char*>(m_end) + sz > m_capacity) {
+        if (is_streaming() && capacity() >= LEAN_COMPACTOR_STREAM_BUFFER_SZ && buffered() > capacity() / 4) {
+            // keep the most recent data, it is the most likely to be compared against by `save_max_sharing`
+            flush(buffered() - capacity() / 4);
+            continue;
+        }
         size_t new_capacity = capacity()*2;
         void * new_begin = malloc(new_capacity);
-        memcpy(new_begin, m_begin, size());
-        m_end      = static_cast<char*>(new_begin) + size();
+        memcpy(new_begin, m_begin, buffered());
+        m_end      = static_cast<char*>(new_begin) + buffered();
         m_capacity = static_cast<char*>(new_begin) + new_capacity;
         free(m_begin);
         m_begin    = new_begin;
@@ -97,31 +256,66 @@ void * object_compactor::alloc(size_t sz) {
 
 void object_compactor::save(object * o, object * new_o) {
     lean_assert(m_begin <= new_o && new_o < m_end);
-    m_obj_table.insert(std::make_pair(o, reinterpret_cast<object_offset>(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin) + reinterpret_cast<size_t>(m_base_addr))));
+    m_obj_table.insert(mix_hash(reinterpret_cast<size_t>(o)), std::make_pair(o, reinterpret_cast<object_offset>(region_offset(new_o) + reinterpret_cast<size_t>(m_base_addr))));
+}
+
+static inline size_t max_sharing_hash(object const * o, size_t sz) {
+    return mix_hash(hash_str(sz, reinterpret_cast<unsigned char const *>(o), 17));
+}
+
+void object_compactor::set_dictionary(compacted_region const & dict) {
+    lean_assert(dict.data() == dict.base_addr());
+    m_dict_begin = static_cast<char *>(dict.data());
+    m_dict_end   = m_dict_begin + dict.size();
+    m_dict_table.reset(new flat_hash_table<object*>(LEAN_MAX_SHARING_TABLE_INITIAL_SIZE));
+    dict.for_each_object([&](object * o) {
+        // `mpz` objects are never shared, see `insert_mpz`
+        if (lean_ptr_tag(o) != LeanMPZ)
+            m_dict_table->insert(max_sharing_hash(o, lean_object_byte_size(o)), o);
+    });
 }
 
 void object_compactor::save_max_sharing(object * o, object * new_o, size_t new_o_sz) {
-    max_sharing_key k(reinterpret_cast<char*>(new_o) - reinterpret_cast<char*>(m_begin), new_o_sz);
-    auto it = m_max_sharing_table->m_table.find(k);
-    if (it != m_max_sharing_table->m_table.end()) {
+    size_t h = max_sharing_hash(new_o, new_o_sz);
+    if (m_dict_table) {
+        // references to dictionary objects are stored as is, so `new_o` can only be equal to a dictionary object
+        // if all its children are in the dictionary as well
+        object ** d = m_dict_table->find(h, [&](object * d) {
+            return lean_object_byte_size(d) == new_o_sz && memcmp(d, new_o, new_o_sz) == 0;
+        });
+        if (d) {
+            m_end = new_o;
+            m_obj_table.insert(mix_hash(reinterpret_cast<size_t>(o)), std::make_pair(o, *d));
+            return;
+        }
+    }
+    max_sharing_key * k = m_max_sharing_table->find(h, [&](max_sharing_key const & k) {
+        return k.m_size == new_o_sz && memcmp(region_data(k.m_offset, k.m_size), new_o, new_o_sz) == 0;
+    });
+    if (k) {
         m_end = new_o;
-        new_o = reinterpret_cast<lean_object*>(reinterpret_cast<char*>(m_begin) + it->m_offset);
+        m_obj_table.insert(mix_hash(reinterpret_cast<size_t>(o)), std::make_pair(o, reinterpret_cast<object_offset>(k->m_offset + reinterpret_cast<size_t>(m_base_addr))));
     } else {
-        m_max_sharing_table->m_table.insert(k);
+        m_max_sharing_table->insert(h, max_sharing_key{region_offset(new_o), new_o_sz});
+        save(o, new_o);
     }
-    save(o, new_o);
+}
+
+object_offset * object_compactor::find_offset(object * o) {
+    auto * e = m_obj_table.find(mix_hash(reinterpret_cast<size_t>(o)), [&](std::pair<object*, object_offset> const & e) { return e.first == o; });
+    return e ? &e->second : nullptr;
 }
 
 object_offset object_compactor::to_offset(object * o) {
-    if (lean_is_scalar(o)) {
+    if (lean_is_scalar(o) || in_dictionary(o)) {
         return o;
     } else {
-        auto it = m_obj_table.find(o);
-        if (it == m_obj_table.end()) {
+        object_offset * r = find_offset(o);
+        if (!r) {
             m_todo.push_back(o);
             return g_null_offset;
         } else {
-            return it->second;
+            return *r;
         }
     }
 }
@@ -271,7 +465,7 @@ void object_compactor::insert_mpz(object * o) {
     // we assume the limb array is the only indirection in an `__mpz_struct` and everything else can be bitcopied
     void * data = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
     memcpy(data, m._mp_d, data_sz);
-    m._mp_d = reinterpret_cast<mp_limb_t *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
+    m._mp_d = reinterpret_cast<mp_limb_t *>(region_offset(data) + reinterpret_cast<ptrdiff_t>(m_base_addr));
     m._mp_alloc = nlimbs;
     save(o, (lean_object*)new_o);
 #else
@@ -282,7 +476,7 @@ void object_compactor::insert_mpz(object * o) {
     lean_set_non_heap_header((lean_object*)new_o, sz, LeanMPZ, 0);
     void * data = reinterpret_cast<char*>(new_o) + sizeof(mpz_object);
     memcpy(data, to_mpz(o)->m_value.m_digits, data_sz);
-    new_o->m_value.m_digits = reinterpret_cast<mpn_digit *>(reinterpret_cast<char *>(data) - reinterpret_cast<char *>(m_begin) + reinterpret_cast<ptrdiff_t>(m_base_addr));
+    new_o->m_value.m_digits = reinterpret_cast<mpn_digit *>(region_offset(data) + reinterpret_cast<ptrdiff_t>(m_base_addr));
     save(o, (lean_object*)new_o);
 #endif
 }
@@ -328,11 +522,13 @@ void object_compactor::operator()(object * o) {
     lean_assert(m_todo.empty());
     // allocate for root address, see end of function
     alloc(sizeof(object_offset));
+    m_chunk_ends.clear();
+    size_t chunk_begin = size();
     if (!lean_is_scalar(o)) {
         m_todo.push_back(o);
         while (!m_todo.empty()) {
             object * curr = m_todo.back();
-            if (m_obj_table.find(curr) != m_obj_table.end()) {
+            if (find_offset(curr)) {
                 m_todo.pop_back();
                 continue;
             }
@@ -354,11 +550,34 @@ void object_compactor::operator()(object * o) {
             case LeanReserved:        lean_unreachable();
             default:                  r = insert_constructor(curr); break;
             }
-            if (r) m_todo.pop_back();
+            if (r) {
+                m_todo.pop_back();
+                // `m_end` is the end of the object just inserted, and it is never moved back further by `save_max_sharing`
+                if (size() - chunk_begin >= LEAN_COMPACTOR_CHUNK_SZ) {
+                    chunk_begin = size();
+                    m_chunk_ends.push_back(chunk_begin);
+                }
+            }
         }
         m_tmp.clear();
     }
-    *static_cast<object_offset *>(m_begin) = to_offset(o);
+    if (m_chunk_ends.empty() || m_chunk_ends.back() != size())
+        m_chunk_ends.push_back(size());
+    size_t num_chunks = m_chunk_ends.size();
+    size_t * index = static_cast<size_t *>(alloc(sizeof(size_t) * (num_chunks + 1)));
+    std::copy(m_chunk_ends.begin(), m_chunk_ends.end(), index);
+    index[num_chunks] = num_chunks;
+    object_offset root = to_offset(o);
+    m_root = root;
+    if (m_flushed == 0) {
+        *static_cast<object_offset *>(m_begin) = root;
+    } else if (m_sink) {
+        m_sink->write(0, reinterpret_cast<char const *>(&root), sizeof(object_offset));
+    } else {
+#ifndef LEAN_WINDOWS
+        write_region_data(m_fd, reinterpret_cast<char const *>(&root), sizeof(object_offset), m_fd_offset);
+#endif
+    }
 }
 
 compacted_region::compacted_region(size_t sz, void * data, void * base_addr, bool is_mmap, std::function<void()> free_data):
@@ -381,24 +600,28 @@ compacted_region::~compacted_region() {
     m_free_data();
 }
 
-inline object * compacted_region::fix_object_ptr(object * o) {
+void compacted_region::set_dictionary(void * dict_base_addr, size_t dict_sz, void * dict_begin) {
+    lean_assert(m_next == m_begin);
+    m_dict_base_addr = reinterpret_cast<size_t>(dict_base_addr);
+    m_dict_end       = m_dict_base_addr + dict_sz;
+    m_dict_begin     = static_cast<char *>(dict_begin);
+}
+
+inline object * compacted_region::fix_object_ptr(object * o) const {
     if (lean_is_scalar(o)) return o;
+    if (reinterpret_cast<size_t>(o) - m_dict_base_addr < m_dict_end - m_dict_base_addr)
+        return reinterpret_cast<object*>(m_dict_begin + (reinterpret_cast<size_t>(o) - m_dict_base_addr));
     return reinterpret_cast<object*>(static_cast<char*>(m_begin) + (reinterpret_cast<size_t>(o) - reinterpret_cast<size_t>(m_base_addr)));
 }
 
-inline void compacted_region::move(size_t d) {
-    lean_assert(m_next < m_end);
+static inline size_t align_object_size(size_t d) {
     size_t rem = d % sizeof(void*);
     if (rem != 0)
         d = d + sizeof(void*) - rem;
-    m_next = static_cast<char*>(m_next) + d;
-}
-
-inline void compacted_region::move(object * o) {
-    return move(lean_object_byte_size(o));
+    return d;
 }
 
-inline void compacted_region::fix_constructor(object * o) {
+inline size_t compacted_region::fix_constructor(object * o) const {
     lean_assert(!lean_has_rc(o));
     object ** it  = lean_ctor_obj_cptr(o);
     object ** end = it + lean_ctor_num_objs(o);
@@ -406,77 +629,245 @@ inline void compacted_region::fix_constructor(object * o) {
         *it = fix_object_ptr(*it);
     }
     lean_assert(lean_object_byte_size(o) < 4192);
-    move(o);
+    return lean_object_byte_size(o);
 }
 
-inline void compacted_region::fix_array(object * o) {
+inline size_t compacted_region::fix_array(object * o) const {
     object ** it  = lean_array_cptr(o);
     object ** end = it + lean_array_size(o);
     for (; it != end; it++) {
         *it = fix_object_ptr(*it);
     }
-    move(o);
+    return lean_object_byte_size(o);
 }
 
-inline void compacted_region::fix_thunk(object * o) {
+inline size_t compacted_region::fix_thunk(object * o) const {
     lean_to_thunk(o)->m_value = fix_object_ptr(lean_to_thunk(o)->m_value);
-    move(sizeof(lean_thunk_object));
+    return sizeof(lean_thunk_object);
 }
 
-inline void compacted_region::fix_ref(object * o) {
+inline size_t compacted_region::fix_ref(object * o) const {
     lean_to_ref(o)->m_value = fix_object_ptr(lean_to_ref(o)->m_value);
-    move(sizeof(lean_ref_object));
+    return sizeof(lean_ref_object);
 }
 
-inline void compacted_region::fix_task(object * o) {
+inline size_t compacted_region::fix_task(object * o) const {
     lean_to_task(o)->m_value = fix_object_ptr(lean_to_task(o)->m_value);
-    move(sizeof(lean_task_object));
+    return sizeof(lean_task_object);
+}
+
+/* Size of a compacted `mpz` object including its limbs, which may not fit into the size stored in its header. */
+size_t compacted_region::mpz_byte_size(object * o) {
+#ifdef LEAN_USE_GMP
+    return sizeof(mpz_object) + sizeof(mp_limb_t) * mpz_size(to_mpz(o)->m_value.m_val);
+#else
+    return sizeof(mpz_object) + sizeof(mpn_digit) * to_mpz(o)->m_value.m_size;
+#endif
 }
 
-void compacted_region::fix_mpz(object * o) {
+size_t compacted_region::fix_mpz(object * o) const {
 #ifdef LEAN_USE_GMP
     __mpz_struct & m = to_mpz(o)->m_value.m_val[0];
     m._mp_d = reinterpret_cast<mp_limb_t *>(static_cast<char *>(m_begin) + reinterpret_cast<size_t>(m._mp_d) - reinterpret_cast<size_t>(m_base_addr));
-    move(sizeof(mpz_object) + sizeof(mp_limb_t) * mpz_size(to_mpz(o)->m_value.m_val));
 #else
     to_mpz(o)->m_value.m_digits = reinterpret_cast<mpn_digit*>(reinterpret_cast<char*>(o) + sizeof(mpz_object));
-    move(sizeof(mpz_object) + sizeof(mpn_digit) * to_mpz(o)->m_value.m_size);
 #endif
+    return mpz_byte_size(o);
 }
 
-object * compacted_region::read() {
-    if (m_next == m_end)
-        return nullptr; /* all objects have been read */
-
-    object * root = fix_object_ptr(*static_cast<object_offset *>(m_next));
-    move(sizeof(object_offset));
-    if (m_begin == m_base_addr) {
-        // no relocations needed
-        m_end = m_next;
-        return root;
-    }
-    lean_assert(!m_is_mmap);
-
-    while (m_next < m_end) {
-        object * curr = reinterpret_cast<object*>(m_next);
+/* Relocate the objects in `[begin, end)`. Only the objects themselves are modified, so disjoint ranges
+   can be relocated concurrently. */
+void compacted_region::fix_objects(char * begin, char * end) const {
+    char * next = begin;
+    while (next < end) {
+        object * curr = reinterpret_cast<object*>(next);
         uint8 tag = lean_ptr_tag(curr);
+        size_t sz;
         if (tag <= LeanMaxCtorTag) {
-            fix_constructor(curr);
+            sz = fix_constructor(curr);
         } else {
             switch (tag) {
             case LeanClosure:         lean_unreachable();
-            case LeanArray:           fix_array(curr); break;
-            case LeanScalarArray:     move(lean_sarray_byte_size(curr)); break;
-            case LeanString:          move(lean_string_byte_size(curr)); break;
-            case LeanMPZ:             fix_mpz(curr); break;
-            case LeanThunk:           fix_thunk(curr); break;
-            case LeanRef:             fix_ref(curr); break;
-            case LeanTask:            fix_task(curr); break;
+            case LeanArray:           sz = fix_array(curr); break;
+            case LeanScalarArray:     sz = lean_sarray_byte_size(curr); break;
+            case LeanString:          sz = lean_string_byte_size(curr); break;
+            case LeanMPZ:             sz = fix_mpz(curr); break;
+            case LeanThunk:           sz = fix_thunk(curr); break;
+            case LeanRef:             sz = fix_ref(curr); break;
+            case LeanTask:            sz = fix_task(curr); break;
             case LeanExternal:        lean_unreachable();
             default:                  lean_unreachable();
             }
         }
+        next += align_object_size(sz);
+    }
+}
+
+/* Return the end of each chunk of objects, as stored by `object_compactor` after the objects. */
+std::vector<char *> compacted_region::read_chunk_index() const {
+    if (!m_has_chunk_index)
+        return std::vector<char *>({static_cast<char *>(m_end)});
+    char * begin = static_cast<char *>(m_begin);
+    char * end   = static_cast<char *>(m_end);
+    size_t num_words = (end - begin) / sizeof(size_t);
+    size_t const * words = static_cast<size_t const *>(m_begin);
+    // the region contains at least the root, one chunk end and the number of chunks
+    size_t num_chunks = num_words >= 3 ? words[num_words - 1] : 0;
+    if (num_chunks == 0 || num_chunks > num_words - 2)
+        throw exception("invalid compacted region, corrupted chunk index");
+    size_t const * index = words + (num_words - 1 - num_chunks);
+    std::vector<char *> chunk_ends;
+    char * prev = begin + sizeof(object_offset);
+    for (size_t i = 0; i < num_chunks; i++) {
+        char * chunk_end = begin + index[i];
+        if (index[i] > static_cast<size_t>(end - begin) || chunk_end < prev || chunk_end > reinterpret_cast<char const *>(index))
+            throw exception("invalid compacted region, corrupted chunk index");
+        chunk_ends.push_back(chunk_end);
+        prev = chunk_end;
+    }
+    if (prev != reinterpret_cast<char const *>(index))
+        throw exception("invalid compacted region, corrupted chunk index");
+    return chunk_ends;
+}
+
+void compacted_region::for_each_object(std::function<void(object *)> const & fn) const {
+    lean_assert(m_next == m_end);
+    char * next = static_cast<char *>(m_begin) + sizeof(object_offset);
+    char * end  = read_chunk_index().back();
+    while (next < end) {
+        object * curr = reinterpret_cast<object*>(next);
+        fn(curr);
+        next += align_object_size(lean_ptr_tag(curr) == LeanMPZ ? mpz_byte_size(curr) : lean_object_byte_size(curr));
     }
+}
+
+#if defined(LEAN_MULTI_THREAD)
+/* Chunks of a region that are relocated in parallel. Chunks become available in order as they are
+   read, and they are claimed by the relocating threads in the same order. */
+class chunk_relocator {
+    mutex              m_mutex;
+    condition_variable m_cv;
+    size_t             m_num_chunks;
+    size_t             m_num_ready{0};
+    size_t             m_next{0};
+    bool               m_aborted{false};
+public:
+    explicit chunk_relocator(size_t num_chunks):m_num_chunks(num_chunks) {}
+
+    void set_ready(size_t num_ready) {
+        lock_guard<mutex> lock(m_mutex);
+        m_num_ready = num_ready;
+        m_cv.notify_all();
+    }
+
+    void abort() {
+        lock_guard<mutex> lock(m_mutex);
+        m_aborted = true;
+        m_cv.notify_all();
+    }
+
+    /* Return the index of the next chunk to relocate, or `m_num_chunks` if there are none left. */
+    size_t claim() {
+        unique_lock<mutex> lock(m_mutex);
+        while (!m_aborted && m_next < m_num_chunks && m_next == m_num_ready)
+            m_cv.wait(lock);
+        if (m_aborted || m_next == m_num_chunks)
+            return m_num_chunks;
+        return m_next++;
+    }
+};
+#endif
+
+/* Relocate the objects of all chunks. If `in` is not `nullptr`, the chunks are read from it first.
+   Return `false` if `in` fails. */
+bool compacted_region::relocate(std::vector<char *> const & chunk_ends, std::istream * in) {
+    size_t num_chunks = chunk_ends.size();
+    auto chunk_begin  = [&](size_t i) { return i == 0 ? static_cast<char *>(m_begin) + sizeof(object_offset) : chunk_ends[i - 1]; };
+    auto read_chunk   = [&](size_t i) {
+        in->read(chunk_begin(i), chunk_ends[i] - chunk_begin(i));
+        return static_cast<bool>(*in);
+    };
+#if defined(LEAN_MULTI_THREAD)
+    unsigned num_threads = std::min(hardware_concurrency(), static_cast<unsigned>(LEAN_MAX_RELOCATION_THREADS));
+    num_threads = static_cast<unsigned>(std::min(static_cast<size_t>(num_threads), num_chunks));
+    if (num_threads > 1) {
+        chunk_relocator relocator(num_chunks);
+        auto run = [&]() {
+            size_t i;
+            while ((i = relocator.claim()) < num_chunks)
+                fix_objects(chunk_begin(i), chunk_ends[i]);
+        };
+        std::vector<std::unique_ptr<lthread>> helpers;
+        for (unsigned i = 1; i < num_threads; i++)
+            helpers.emplace_back(new lthread(run));
+        bool ok = true;
+        if (in) {
+            for (size_t i = 0; i < num_chunks; i++) {
+                if (!read_chunk(i)) {
+                    ok = false;
+                    relocator.abort();
+                    break;
+                }
+                relocator.set_ready(i + 1);
+            }
+        } else {
+            relocator.set_ready(num_chunks);
+        }
+        run();
+        for (auto & h : helpers)
+            h->join();
+        return ok;
+    }
+#endif
+    for (size_t i = 0; i < num_chunks; i++) {
+        if (in && !read_chunk(i))
+            return false;
+        fix_objects(chunk_begin(i), chunk_ends[i]);
+    }
+    return true;
+}
+
+object * compacted_region::read() {
+    if (m_next == m_end)
+        return nullptr; /* all objects have been read */
+
+    object * root = fix_object_ptr(*static_cast<object_offset *>(m_next));
+    if (m_begin != m_base_addr || m_dict_begin != reinterpret_cast<char *>(m_dict_base_addr)) {
+        lean_assert(!m_is_mmap);
+        relocate(read_chunk_index(), nullptr);
+    }
+    // there is a single root, see `object_compactor::operator()`
+    m_next = m_end;
+    return root;
+}
+
+object * compacted_region::read(std::istream & in) {
+    lean_assert(!m_is_mmap);
+    lean_assert(m_next == m_begin);
+    std::streampos pos = in.tellg();
+    if (m_has_chunk_index) {
+        // read the chunk index at the end of the region first
+        size_t sz = static_cast<char *>(m_end) - static_cast<char *>(m_begin);
+        size_t num_chunks = 0;
+        if (sz >= sizeof(size_t)) {
+            in.seekg(pos + static_cast<std::streamoff>(sz - sizeof(size_t)));
+            in.read(reinterpret_cast<char *>(&num_chunks), sizeof(size_t));
+        }
+        if (!in || num_chunks >= sz / sizeof(size_t))
+            throw exception("invalid compacted region, corrupted chunk index");
+        size_t index_sz = sizeof(size_t) * (num_chunks + 1);
+        in.seekg(pos + static_cast<std::streamoff>(sz - index_sz));
+        in.read(static_cast<char *>(m_end) - index_sz, index_sz);
+    }
+    in.seekg(pos);
+    in.read(static_cast<char *>(m_begin), sizeof(object_offset));
+    if (!in)
+        return nullptr;
+    std::vector<char *> chunk_ends = read_chunk_index();
+    if (!relocate(chunk_ends, &in))
+        return nullptr;
+    object * root = fix_object_ptr(*static_cast<object_offset *>(m_begin));
+    m_next = m_end;
     return root;
 }
 
@@ -484,6 +875,10 @@ extern "C" LEAN_EXPORT uint8 lean_compacted_region_is_memory_mapped(usize region
     return reinterpret_cast<compacted_region *>(region)->is_memory_mapped();
 }
 
+extern "C" LEAN_EXPORT usize lean_compacted_region_size(usize region) {
+    return reinterpret_cast<compacted_region *>(region)->size();
+}
+
 extern "C" LEAN_EXPORT obj_res lean_compacted_region_free(usize region, object *) {
     delete reinterpret_cast<compacted_region *>(region);
     return lean_io_result_mk_ok(lean_box(0));
@@ -6,32 +6,77 @@ Author: Leonardo de Moura
 */
 #pragma once
 #include <functional>
+#include <iosfwd>
 #include <vector>
-#include <unordered_map>
 #include "runtime/object.h"
+#include "runtime/flat_hash_table.h"
 
 namespace lean {
 typedef lean_object * object_offset;
+class compacted_region;
+
+/* Destination of the region data of a compactor that does not write it to a file directly, see
+   `object_compactor(void *, compactor_sink &)`. */
+class compactor_sink {
+public:
+    virtual ~compactor_sink() {}
+    /* Write the region data `[offset, offset + sz)`. The data is written in order, except for the root at offset 0,
+       which is overwritten last when the data following it has already been written. */
+    virtual void write(size_t offset, char const * data, size_t sz) = 0;
+    /* Return the region data `[offset, offset + sz)`, which has been written already. The result is only valid until
+       the next call. */
+    virtual char const * read(size_t offset, size_t sz) = 0;
+};
 
 class object_compactor {
-    struct max_sharing_table;
-    friend struct max_sharing_hash;
-    friend struct max_sharing_eq;
-    std::unordered_map<object*, object_offset, std::hash<object*>, std::equal_to<object*>> m_obj_table;
-    std::unique_ptr<max_sharing_table> m_max_sharing_table;
+    struct max_sharing_key;
+    flat_hash_table<std::pair<object*, object_offset>> m_obj_table;
+    std::unique_ptr<flat_hash_table<max_sharing_key>> m_max_sharing_table;
+    // Objects of the dictionary region `[m_dict_begin, m_dict_end)` by contents, see `set_dictionary`
+    std::unique_ptr<flat_hash_table<object*>> m_dict_table;
+    char * m_dict_begin = nullptr;
+    char * m_dict_end   = nullptr;
     std::vector<object*> m_todo;
     std::vector<object_offset> m_tmp;
+    // Object-aligned offsets at which the objects are split into chunks that can be relocated independently,
+    // see `compacted_region::read`. They are stored after the objects, followed by their number.
+    std::vector<size_t> m_chunk_ends;
     // On-disk base address used for `mmap`ing compacted regions without relocations
     // References within the compacted region are rewritten by subtracting `m_begin` and adding `m_base_addr`
     // In the simplest case `base_addr == nullptr`, we get region-relative pointers
     void * m_base_addr;
+    // When `m_fd != -1`, the region is streamed to the file `m_fd` starting at `m_fd_offset`, and the buffer
+    // `[m_begin, m_end)` only contains the region data starting at offset `m_flushed`. The same holds for `m_sink`.
+    int    m_fd;
+    compactor_sink * m_sink;
+    size_t m_fd_offset;
+    size_t m_flushed;
+    // Read-only mapping of the file starting at the page containing `m_fd_offset`, through which `region_data` reads
+    // back flushed data. It may extend past the end of the file, but only flushed data is accessed.
+    char * m_flushed_map;
+    size_t m_flushed_map_sz;
+    bool   m_flushed_map_failed;
+    std::vector<char> m_scratch;
+    // Hash of the flushed region data except for the root, see `content_hash`
+    uint64 m_hash;
+    object_offset m_root;
     void * m_begin;
     void * m_end;
     void * m_capacity;
     size_t capacity() const { return static_cast<char*>(m_capacity) - static_cast<char*>(m_begin); }
+    size_t buffered() const { return static_cast<char*>(m_end) - static_cast<char*>(m_begin); }
+    bool is_streaming() const { return m_fd != -1 || m_sink; }
+    size_t region_offset(void * p) const { return m_flushed + (static_cast<char*>(p) - static_cast<char*>(m_begin)); }
+    void flush(size_t n);
+    char const * map_flushed(size_t end);
+    char const * region_data(size_t offset, size_t sz);
     void save(object * o, object * new_o);
     void save_max_sharing(object * o, object * new_o, size_t new_o_sz);
     void * alloc(size_t sz);
+    object_offset * find_offset(object * o);
+    bool in_dictionary(object * o) const {
+        return reinterpret_cast<size_t>(o) - reinterpret_cast<size_t>(m_dict_begin) < static_cast<size_t>(m_dict_end - m_dict_begin);
+    }
     object_offset to_offset(object * o);
     void insert_terminator(object * o);
     object * copy_object(object * o);
@@ -45,14 +90,30 @@ class object_compactor {
     void insert_mpz(object * o);
 public:
     object_compactor(void * base_addr = nullptr);
+    /* Creates an object compactor that writes the compacted region to the file `fd` at `fd_offset`, keeping only a
+       bounded amount of it in memory. `fd` must be open for reading and writing. `finish` must be called after the
+       last object has been compacted. */
+    object_compactor(void * base_addr, int fd, size_t fd_offset);
+    /* Creates an object compactor that writes the compacted region to `sink` instead, see above. */
+    object_compactor(void * base_addr, compactor_sink & sink);
     object_compactor(object_compactor const &) = delete;
     object_compactor(object_compactor &&) = delete;
     ~object_compactor();
     object_compactor operator=(object_compactor const &) = delete;
     object_compactor operator=(object_compactor &&) = delete;
+    /* Use the objects of the compacted region `dict`, which must be mapped at its base address, as a dictionary:
+       objects of `dict`, and objects with the same contents as one of them, are referenced by their address in `dict`
+       instead of being copied. The compacted region can only be read with `dict` loaded, see
+       `compacted_region::set_dictionary`. */
+    void set_dictionary(compacted_region const & dict);
     void operator()(object * o);
-    size_t size() const { return static_cast<char*>(m_end) - static_cast<char*>(m_begin); }
-    void const * data() const { return m_begin; }
+    /* Write the remaining region data, only for compactors created with a file or a sink. */
+    void finish();
+    size_t size() const { return m_flushed + buffered(); }
+    /* Hash of the compacted region. It is computed while the region is written to the file, and does not depend on
+       whether the compactor writes to a file. */
+    uint64 content_hash() const;
+    void const * data() const { lean_assert(!is_streaming()); return m_begin; }
 };
 
 class compacted_region {
@@ -63,15 +124,22 @@ class compacted_region {
     void * m_begin;
     void * m_next;
     void * m_end;
-    void move(size_t d);
-    void move(object * o);
-    object * fix_object_ptr(object * o);
-    void fix_constructor(object * o);
-    void fix_array(object * o);
-    void fix_thunk(object * o);
-    void fix_ref(object * o);
-    void fix_task(object * o);
-    void fix_mpz(object * o);
+    // Dictionary region `[m_dict_base_addr, m_dict_end)` referenced by the objects, loaded at `m_dict_begin`
+    size_t m_dict_base_addr = 0;
+    size_t m_dict_end       = 0;
+    char * m_dict_begin     = nullptr;
+    bool m_has_chunk_index  = true;
+    object * fix_object_ptr(object * o) const;
+    size_t fix_constructor(object * o) const;
+    size_t fix_array(object * o) const;
+    size_t fix_thunk(object * o) const;
+    size_t fix_ref(object * o) const;
+    size_t fix_task(object * o) const;
+    size_t fix_mpz(object * o) const;
+    static size_t mpz_byte_size(object * o);
+    void fix_objects(char * begin, char * end) const;
+    std::vector<char *> read_chunk_index() const;
+    bool relocate(std::vector<char *> const & chunk_ends, std::istream * in);
 public:
     /* Creates a compacted object region using the given region in memory.
        This object takes ownership of the region. */
@@ -84,7 +152,21 @@ public:
     ~compacted_region();
     compacted_region operator=(compacted_region const &) = delete;
     compacted_region operator=(compacted_region &&) = delete;
+    /* Relocate the references to objects of the dictionary region of size `dict_sz` at base address `dict_base_addr`,
+       see `object_compactor::set_dictionary`, to the dictionary loaded at `dict_begin`. Must be called before `read`. */
+    void set_dictionary(void * dict_base_addr, size_t dict_sz, void * dict_begin);
+    /* Mark the region as written without the chunk index, as regions were before it was introduced. The region is
+       then relocated as a single chunk. Must be called before `read`. */
+    void set_no_chunk_index() { m_has_chunk_index = false; }
+    /* Apply `fn` to each object of a region that has already been read. */
+    void for_each_object(std::function<void(object *)> const & fn) const;
     object * read();
+    /* Same as `read()`, but the region data is first read from `in`. Chunks of the region are relocated in
+       parallel while later chunks are still being read. Return `nullptr` if `in` fails. */
+    object * read(std::istream & in);
     bool is_memory_mapped() const { return m_is_mmap; }
+    void * base_addr() const { return m_base_addr; }
+    void * data() const { return m_begin; }
+    size_t size() const { return static_cast<char *>(m_end) - static_cast<char *>(m_begin); }
 };
 }
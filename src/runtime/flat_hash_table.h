@@ -0,0 +1,169 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include "runtime/debug.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace lean {
+/**
+   \brief Open addressing hash table with Swiss table style probing.
+
+   Each slot has a control byte that is either `ctrl_empty` or the lower 7 bits of the hash of its entry.
+   Slots are probed in groups of `group_size` control bytes, which are matched against the hash in a single
+   SSE2 comparison when available. Groups are visited in triangular order, which visits every group since
+   the number of groups is a power of two.
+
+   The hash of every entry is given by the caller and stored next to it, so the table never rehashes
+   entries and the entries are never compared unless their full hashes match. Entries cannot be erased. */
+template<typename Entry>
+class flat_hash_table {
+public:
+    static constexpr unsigned group_size = 16;
+private:
+    static constexpr uint8_t ctrl_empty = 0x80;
+    struct slot {
+        size_t m_hash;
+        Entry  m_entry;
+    };
+    uint8_t * m_ctrl     = nullptr;
+    slot *    m_slots    = nullptr;
+    size_t    m_capacity = 0; // number of slots, a multiple of `group_size` and a power of two
+    size_t    m_size     = 0;
+
+    static uint8_t h2(size_t h) { return static_cast<uint8_t>(h & 0x7f); }
+    size_t num_groups() const { return m_capacity / group_size; }
+    size_t first_group(size_t h) const { return (h >> 7) & (num_groups() - 1); }
+
+    /* Bit `i` of the result is set iff control byte `i` of the group at `g` is `c`. */
+    static unsigned match(uint8_t const * g, uint8_t c) {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<__m128i const *>(g));
+        return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(c)), group)));
+#else
+        unsigned r = 0;
+        for (unsigned i = 0; i < group_size; i++)
+            if (g[i] == c) r |= 1u << i;
+        return r;
+#endif
+    }
+
+    static unsigned first_bit(unsigned bits) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_ctz(bits));
+#else
+        unsigned i = 0;
+        while (!(bits & (1u << i))) i++;
+        return i;
+#endif
+    }
+
+    void insert_new(size_t h, Entry && e) {
+        size_t g = first_group(h);
+        for (size_t i = 1; ; i++) {
+            unsigned empty = match(m_ctrl + g * group_size, ctrl_empty);
+            if (empty) {
+                size_t idx = g * group_size + first_bit(empty);
+                m_ctrl[idx] = h2(h);
+                new (&m_slots[idx]) slot{h, std::move(e)};
+                m_size++;
+                return;
+            }
+            g = (g + i) & (num_groups() - 1);
+        }
+    }
+
+    void resize(size_t new_capacity) {
+        uint8_t * old_ctrl  = m_ctrl;
+        slot *    old_slots = m_slots;
+        size_t    old_cap   = m_capacity;
+        m_capacity = new_capacity;
+        m_size     = 0;
+        m_ctrl     = static_cast<uint8_t *>(malloc(m_capacity));
+        m_slots    = static_cast<slot *>(malloc(sizeof(slot) * m_capacity));
+        memset(m_ctrl, ctrl_empty, m_capacity);
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old_ctrl[i] != ctrl_empty) {
+                insert_new(old_slots[i].m_hash, std::move(old_slots[i].m_entry));
+                old_slots[i].~slot();
+            }
+        }
+        free(old_ctrl);
+        free(old_slots);
+    }
+
+public:
+    explicit flat_hash_table(size_t initial_capacity = 1024) {
+        size_t cap = group_size;
+        while (cap < initial_capacity) cap *= 2;
+        resize(cap);
+    }
+
+    flat_hash_table(flat_hash_table const &) = delete;
+    flat_hash_table & operator=(flat_hash_table const &) = delete;
+
+    ~flat_hash_table() {
+        for (size_t i = 0; i < m_capacity; i++)
+            if (m_ctrl[i] != ctrl_empty)
+                m_slots[i].~slot();
+        free(m_ctrl);
+        free(m_slots);
+    }
+
+    size_t size() const { return m_size; }
+
+    /** \brief Remove all entries, keeping the allocated slots. */
+    void clear() {
+        for (size_t i = 0; i < m_capacity; i++)
+            if (m_ctrl[i] != ctrl_empty)
+                m_slots[i].~slot();
+        memset(m_ctrl, ctrl_empty, m_capacity);
+        m_size = 0;
+    }
+
+    /** \brief Make room for `n` entries, so that inserting them does not resize the table. */
+    void reserve(size_t n) {
+        size_t cap = m_capacity;
+        while (n * 8 > cap * 7) cap *= 2;
+        if (cap != m_capacity)
+            resize(cap);
+    }
+
+    /** \brief Return the entry with hash `h` satisfying `eq`, or `nullptr`. */
+    template<typename Eq>
+    Entry * find(size_t h, Eq const & eq) {
+        uint8_t c = h2(h);
+        size_t g  = first_group(h);
+        for (size_t i = 1; ; i++) {
+            uint8_t const * ctrl = m_ctrl + g * group_size;
+            unsigned candidates = match(ctrl, c);
+            while (candidates) {
+                unsigned j = first_bit(candidates);
+                slot & s   = m_slots[g * group_size + j];
+                if (s.m_hash == h && eq(s.m_entry))
+                    return &s.m_entry;
+                candidates &= candidates - 1;
+            }
+            if (match(ctrl, ctrl_empty))
+                return nullptr;
+            g = (g + i) & (num_groups() - 1);
+        }
+    }
+
+    /** \brief Insert `e` with hash `h`. The table must not contain an entry equal to `e`. */
+    void insert(size_t h, Entry e) {
+        // keep the load factor below 7/8
+        if ((m_size + 1) * 8 > m_capacity * 7)
+            resize(m_capacity * 2);
+        insert_new(h, std::move(e));
+    }
+};
+}
@@ -5,6 +5,7 @@ Released under Apache 2.0 license as described in the file LICENSE.
 Author: Leonardo de Moura
 */
 #include <limits>
+#include <lean/lean.h>
 #include "runtime/thread.h"
 #include "runtime/interrupt.h"
 #include "runtime/exception.h"
@@ -42,8 +43,13 @@ LEAN_THREAD_VALUE(atomic_bool *, g_interrupt_flag, nullptr);
 
 scoped_interrupt_flag::scoped_interrupt_flag(atomic_bool * flag) : flet(g_interrupt_flag, flag) {}
 
+LEAN_THREAD_VALUE(bool, g_interrupt_on_task_cancel, false);
+
+scoped_interrupt_on_task_cancel::scoped_interrupt_on_task_cancel() : flet(g_interrupt_on_task_cancel, true) {}
+
 static bool interrupt_requested() {
-    return g_interrupt_flag && g_interrupt_flag->load();
+    return (g_interrupt_flag && g_interrupt_flag->load()) ||
+        (g_interrupt_on_task_cancel && lean_io_check_canceled_core());
 }
 
 void check_interrupted() {
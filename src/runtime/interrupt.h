@@ -46,6 +46,12 @@ struct scoped_interrupt_flag : flet<atomic_bool *> {
     scoped_interrupt_flag(atomic_bool *); // NOLINT
 };
 
+/** \brief Make `check_interrupted` also throw when the task being executed by the current thread has been canceled,
+    until the end of the scope. */
+struct scoped_interrupt_on_task_cancel : flet<bool> {
+    scoped_interrupt_on_task_cancel();
+};
+
 /**
    \brief Throw an interrupted exception if the (interrupt) flag is set.
 */
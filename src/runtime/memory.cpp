@@ -10,6 +10,7 @@ Author: Leonardo de Moura
 #include "runtime/exception.h"
 #include "runtime/memory.h"
 #include "runtime/thread.h"
+#include "runtime/alloc.h"
 
 #ifndef LEAN_CHECK_MEM_THRESHOLD
 #define LEAN_CHECK_MEM_THRESHOLD 200
@@ -134,9 +135,20 @@ void check_memory(char const * component_name) {
     g_counter++;
     if (g_counter >= LEAN_CHECK_MEM_THRESHOLD) {
         g_counter = 0;
+        // The allocator knows how much memory it currently holds for Lean objects: the committed
+        // small object pages and the live big objects. Unlike the RSS, this value is cheap to query,
+        // and it drops as soon as memory is released. Other memory (e.g. C++ data structures) is
+        // not limited.
+        size_t r = get_committed_memory();
+        if (r > 0) {
+            if (r >= g_max_memory)
+                throw_memory_exception(component_name);
+            return;
+        }
+        // The small object allocator is disabled, fall back to the RSS.
         // We try first get_peak_rss because it is much faster
         // than get_current_rss on Linux.
-        size_t r = get_peak_rss();
+        r = get_peak_rss();
         if (r > 0 && r < g_max_memory) return;
         r = get_current_rss();
         if (r == 0 || r < g_max_memory) return;
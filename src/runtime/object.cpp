@@ -8,7 +8,11 @@ Author: Leonardo de Moura
 #include <algorithm>
 #include <vector>
 #include <deque>
+#include <memory>
+#include <fstream>
+#include <iostream>
 #include <cmath>
+#include <limits>
 #include <lean/lean.h>
 #include "runtime/object.h"
 #include "runtime/thread.h"
@@ -21,6 +25,7 @@ Author: Leonardo de Moura
 #include "runtime/buffer.h"
 #include "runtime/io.h"
 #include "runtime/hash.h"
+#include "runtime/task_deque.h"
 
 #ifdef __GLIBC__
 #include <execinfo.h>
@@ -206,6 +211,56 @@ static inline lean_object * pop_back(lean_object * & todo) {
     return r;
 }
 
+// =======================================
+// Deferred reference counting
+
+/* When the environment variable `LEAN_DEFERRED_RC` is set to a positive number `n`, standard task manager workers
+   do not apply decrements of multi-threaded objects immediately. Instead, they are accumulated in a thread local
+   direct-mapped table with (at least) `n` entries. Repeated decrements of the same object are coalesced, and the
+   pending count of an entry is applied with a single atomic operation when the entry is evicted by another object
+   or when the worker becomes idle. This reduces contention on the reference counters of objects shared by all
+   threads, such as `Expr` and `Name` objects stored in the environment.
+
+   Deferring decrements is safe since increments are still applied immediately: objects are only freed later.
+   Moreover, multi-threaded objects are never exclusive (see `lean_is_exclusive`), so destructive updates are
+   not affected. */
+static unsigned g_deferred_rc_capacity = 0;
+
+struct deferred_rc_entry {
+    lean_object * m_obj{nullptr};
+    int           m_count{0};
+};
+
+struct deferred_rc_buffer {
+    std::vector<deferred_rc_entry> m_entries;
+    bool                           m_freeing{false};
+};
+
+LEAN_THREAD_PTR(deferred_rc_buffer, g_deferred_rc);
+
+static bool defer_dec_mt(lean_object * o);
+
+// =======================================
+// Background deallocation
+
+/* When the environment variable `LEAN_BACKGROUND_FREE` is set to a positive number `n`, a thread dropping the
+   last reference to a multi-threaded object frees at most `n` dead multi-threaded objects, and hands the rest of the
+   dead graph to a background reclaimer thread. Thus dropping a large shared structure (e.g. an old `Environment`)
+   has bounded latency.
+
+   All objects reachable from a multi-threaded object are multi-threaded or persistent, so the reclaimer can
+   update their reference counters atomically. Dead single-threaded objects are always freed by their owner thread,
+   since their reference counters are not updated atomically. The reclaimer returns small objects to the heaps that
+   allocated them using the remote free lists of the small object allocator.
+
+   If the reclaimer is lagging behind, i.e., it has `LEAN_MAX_PENDING_RECLAIM` pending graphs, dead objects are freed
+   synchronously again to bound memory usage. */
+#define LEAN_MAX_PENDING_RECLAIM 2
+static unsigned g_free_budget = 0;
+
+/* Dead multi-threaded objects of the current thread that have not been freed yet. Only used if `g_free_budget != 0`. */
+LEAN_THREAD_PTR(object, g_dead_mt);
+
 static inline void dec(lean_object * o, lean_object* & todo) {
     if (lean_is_scalar(o))
         return;
@@ -215,8 +270,13 @@ static inline void dec(lean_object * o, lean_object* & todo) {
         push_back(todo, o);
     } else if (o->m_rc == 0) {
         return;
+    } else if (LEAN_UNLIKELY(g_deferred_rc_capacity != 0) && defer_dec_mt(o)) {
+        return;
     } else if (std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
-        push_back(todo, o);
+        if (LEAN_UNLIKELY(g_free_budget != 0))
+            push_back(g_dead_mt, o);
+        else
+            push_back(todo, o);
     }
 }
 
@@ -299,18 +359,181 @@ static void lean_del_core(object * o, object * & todo) {
     }
 }
 
-extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
-    if (o->m_rc == 1 || std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
-#ifdef LEAN_LAZY_RC
-        push_back(g_to_free, o);
+/* Free the objects in `todo` and `g_dead_mt`, and all objects that become dead.
+   At most `budget` multi-threaded objects are freed, the remaining ones are handed to the reclaimer. */
+static void free_dead_objects(object * todo, size_t budget);
+
+#if defined(LEAN_MULTI_THREAD)
+class reclaimer {
+    mutex                 m_mutex;
+    condition_variable    m_cv;
+    std::vector<object *> m_lists;
+    /* Number of lists in `m_lists` or being freed. */
+    std::atomic<unsigned> m_num_pending{0};
+    bool                  m_started{false};
+
+    void main() {
+        unique_lock<mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [&]() { return !m_lists.empty(); });
+            std::vector<object *> lists;
+            lists.swap(m_lists);
+            lock.unlock();
+            for (object * l : lists) {
+                g_dead_mt = l;
+                free_dead_objects(nullptr, std::numeric_limits<size_t>::max());
+                m_num_pending--;
+            }
+            lock.lock();
+        }
+    }
+
+public:
+    bool is_lagging() const { return m_num_pending.load(std::memory_order_relaxed) >= LEAN_MAX_PENDING_RECLAIM; }
+
+    /* Take ownership of the list of dead multi-threaded objects `l`. */
+    void push(object * l) {
+        m_num_pending++;
+        lock_guard<mutex> lock(m_mutex);
+        if (!m_started) {
+            m_started = true;
+            // `lthread` will be implicitly freed, see `task_manager::spawn_worker`
+            lthread([this]() { main(); });
+        }
+        m_lists.push_back(l);
+        m_cv.notify_one();
+    }
+};
+
+static reclaimer * g_reclaimer = nullptr;
+#endif
+
+static void free_dead_objects(object * todo, size_t budget) {
+    while (true) {
+        object * o;
+        if (todo != nullptr) {
+            o = pop_back(todo);
+        } else if (g_dead_mt == nullptr) {
+            return;
+        } else if (budget == 0) {
+#if defined(LEAN_MULTI_THREAD)
+            if (!g_reclaimer->is_lagging()) {
+                g_reclaimer->push(g_dead_mt);
+                g_dead_mt = nullptr;
+                return;
+            }
+            budget = std::numeric_limits<size_t>::max();
+            continue;
 #else
-        object * todo = nullptr;
+            lean_unreachable();
+#endif
+        } else {
+            budget--;
+            o = pop_back(g_dead_mt);
+        }
+        lean_del_core(o, todo);
+    }
+}
+
+/* Free the dead object `o`, and all objects that become dead. */
+static void free_dead_object(object * o, bool mt) {
+    object * todo = nullptr;
+    if (LEAN_LIKELY(g_free_budget == 0)) {
         while (true) {
             lean_del_core(o, todo);
             if (todo == nullptr)
                 return;
             o = pop_back(todo);
         }
+    } else if (mt) {
+        push_back(g_dead_mt, o);
+        free_dead_objects(todo, g_free_budget);
+    } else {
+        push_back(todo, o);
+        free_dead_objects(todo, g_free_budget);
+    }
+}
+
+static void apply_deferred_dec(deferred_rc_buffer & b, lean_object * o, int n) {
+    if (std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), n, std::memory_order_acq_rel) == -n) {
+        /* Decrements performed while freeing objects are applied immediately,
+           otherwise evictions could trigger nested deallocations. */
+        flet<bool> freeing(b.m_freeing, true);
+        free_dead_object(o, true);
+    }
+}
+
+/* Apply the pending decrements of the current thread. */
+static void flush_thread_deferred_rc() {
+    deferred_rc_buffer * b = g_deferred_rc;
+    if (b == nullptr || b->m_freeing)
+        return;
+    for (deferred_rc_entry & e : b->m_entries) {
+        if (e.m_obj != nullptr) {
+            lean_object * o = e.m_obj;
+            int n           = e.m_count;
+            e.m_obj         = nullptr;
+            apply_deferred_dec(*b, o, n);
+        }
+    }
+}
+
+static void finalize_deferred_rc(void * p) {
+    flush_thread_deferred_rc();
+    g_deferred_rc = nullptr;
+    delete static_cast<deferred_rc_buffer *>(p);
+}
+
+/* Must be invoked by standard task manager workers only, since they flush their buffers when they become idle. */
+static void init_thread_deferred_rc() {
+    if (g_deferred_rc_capacity == 0 || g_deferred_rc != nullptr)
+        return;
+    deferred_rc_buffer * b = new deferred_rc_buffer();
+    unsigned capacity = 1;
+    while (capacity < g_deferred_rc_capacity)
+        capacity *= 2;
+    b->m_entries.resize(capacity);
+    g_deferred_rc = b;
+    register_thread_finalizer(finalize_deferred_rc, b);
+}
+
+/* Record a decrement of the multi-threaded object `o` in the table of the current thread.
+   Return false if the decrement must be applied immediately. */
+static bool defer_dec_mt(lean_object * o) {
+    deferred_rc_buffer * b = g_deferred_rc;
+    if (b == nullptr || b->m_freeing || o->m_rc == -1) {
+        /* There is nothing to coalesce if we are the last owner. */
+        return false;
+    }
+    size_t h = reinterpret_cast<size_t>(o) >> 4;
+    deferred_rc_entry & e = b->m_entries[(h ^ (h >> 12)) & (b->m_entries.size() - 1)];
+    if (e.m_obj == o) {
+        e.m_count++;
+    } else {
+        lean_object * old = e.m_obj;
+        int n             = e.m_count;
+        e.m_obj   = o;
+        e.m_count = 1;
+        if (old != nullptr)
+            apply_deferred_dec(*b, old, n);
+    }
+    return true;
+}
+
+extern "C" LEAN_EXPORT void lean_dec_ref_cold(lean_object * o) {
+    if (o->m_rc != 1 && LEAN_UNLIKELY(g_deferred_rc_capacity != 0) && defer_dec_mt(o))
+        return;
+    if (o->m_rc == 1) {
+#ifdef LEAN_LAZY_RC
+        push_back(g_to_free, o);
+#else
+        free_dead_object(o, false);
+#endif
+    } else if (std::atomic_fetch_add_explicit(lean_get_rc_mt_addr(o), 1, std::memory_order_acq_rel) == -1) {
+#ifdef LEAN_LAZY_RC
+        push_back(g_to_free, o);
+#else
+        free_dead_object(o, true);
 #endif
     }
 }
@@ -394,157 +617,355 @@ extern "C" LEAN_EXPORT b_obj_res lean_thunk_get_core(b_obj_arg t) {
 }
 
 // =======================================
-// Mark Persistent
+// Mark MT and persistent
+
+/* Marking stops at objects that do not need to be visited, e.g. at multi-threaded subgraphs in `lean_mark_mt`,
+   and at persistent (e.g. compacted region) subgraphs in both functions. Thus the cost of a call is proportional to
+   the number of objects whose header is actually changed. When this number exceeds `LEAN_PARALLEL_MARK_THRESHOLD`,
+   the remaining objects are marked in parallel with the help of up to `LEAN_MAX_PARALLEL_MARK_THREADS - 1` task
+   manager workers. */
+#define LEAN_PARALLEL_MARK_THRESHOLD 65536
+#define LEAN_PARALLEL_MARK_CHUNK     1024
+#define LEAN_MAX_PARALLEL_MARK_THREADS 16
+
+/* Counters of a marking function. They are updated by every call, so each thread uses one of
+   `LEAN_NUM_MARK_COUNTER_STRIPES` stripes on its own cache line, see `get_mark_counters`, and `IO.getMarkStats`
+   adds them up. */
+#define LEAN_NUM_MARK_COUNTER_STRIPES 64
+
+struct mark_counters {
+    std::atomic<uint64_t> m_num_calls{0};
+    std::atomic<uint64_t> m_num_marked{0};
+    std::atomic<uint64_t> m_max_marked{0};
+    std::atomic<uint64_t> m_num_parallel{0};
+
+    void add(size_t num_marked, bool parallel) {
+        m_num_calls.fetch_add(1, std::memory_order_relaxed);
+        m_num_marked.fetch_add(num_marked, std::memory_order_relaxed);
+        uint64_t max = m_max_marked.load(std::memory_order_relaxed);
+        while (num_marked > max && !m_max_marked.compare_exchange_weak(max, num_marked, std::memory_order_relaxed)) {}
+        if (parallel)
+            m_num_parallel.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+/* 64 bytes, aligned to a cache line */
+struct alignas(64) mark_counter_stripe {
+    mark_counters m_mt;
+    mark_counters m_persistent;
+};
+
+static mark_counter_stripe g_mark_counters[LEAN_NUM_MARK_COUNTER_STRIPES];
+static std::atomic<unsigned> g_next_mark_counter_stripe{0};
+LEAN_THREAD_VALUE(mark_counter_stripe *, g_thread_mark_counters, nullptr);
+
+static mark_counter_stripe & get_mark_counters() {
+    if (LEAN_UNLIKELY(g_thread_mark_counters == nullptr))
+        g_thread_mark_counters = &g_mark_counters[g_next_mark_counter_stripe++ % LEAN_NUM_MARK_COUNTER_STRIPES];
+    return *g_thread_mark_counters;
+}
+
+/* True if the current thread is a helper of a parallel marking, then nested calls
+   (via `external_object_class::m_foreach`) must use atomic operations as well. */
+LEAN_THREAD_VALUE(bool, g_marking_concurrently, false);
 
 extern "C" void lean_mark_persistent(object * o);
+extern "C" void lean_mark_mt(object * o);
 
 static obj_res mark_persistent_fn(obj_arg o) {
     lean_mark_persistent(o);
     return lean_box(0);
 }
 
+static obj_res mark_mt_fn(obj_arg o) {
+    lean_mark_mt(o);
+    lean_dec(o);
+    return lean_box(0);
+}
+
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
 #include <sanitizer/lsan_interface.h>
 #endif
 #endif
 
-extern "C" LEAN_EXPORT void lean_mark_persistent(object * o) {
-    buffer<object*> todo;
-    todo.push_back(o);
-    while (!todo.empty()) {
-        object * o = todo.back();
-        todo.pop_back();
-        if (!lean_is_scalar(o) && lean_has_rc(o)) {
+struct mark_persistent_fns {
+    static mark_counters & counters() { return get_mark_counters().m_persistent; }
+    static bool should_visit(object * o) { return !lean_is_scalar(o) && lean_has_rc(o); }
+    /* Return true if `o` must be visited by the current thread */
+    static bool claim(object * o, bool concurrent) {
+        if (concurrent) {
+            if (std::atomic_exchange_explicit(lean_get_rc_mt_addr(o), 0, std::memory_order_relaxed) == 0)
+                return false;
+        } else {
             o->m_rc = 0;
+        }
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
-            // do not report as leak
-            // NOTE: Most persistent objects are actually reachable from global
-            // variables up to the end of the process. However, this is *not*
-            // true for closures inside of persistent thunks, which are
-            // "orphaned" after being evaluated.
-            __lsan_ignore_object(o);
+        // do not report as leak
+        // NOTE: Most persistent objects are actually reachable from global
+        // variables up to the end of the process. However, this is *not*
+        // true for closures inside of persistent thunks, which are
+        // "orphaned" after being evaluated.
+        __lsan_ignore_object(o);
 #endif
 #endif
-            uint8_t tag = lean_ptr_tag(o);
-            if (tag <= LeanMaxCtorTag) {
-                object ** it  = lean_ctor_obj_cptr(o);
-                object ** end = it + lean_ctor_num_objs(o);
-                for (; it != end; ++it) todo.push_back(*it);
-            } else {
-                switch (tag) {
-                case LeanScalarArray:
-                case LeanString:
-                case LeanMPZ:
-                    break;
-                case LeanExternal: {
-                    object * fn = lean_alloc_closure((void*)mark_persistent_fn, 1, 0);
-                    lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
-                    lean_dec(fn);
-                    break;
-                }
-                case LeanTask:
-                    todo.push_back(lean_task_get(o));
-                    break;
-                case LeanClosure: {
-                    object ** it  = lean_closure_arg_cptr(o);
-                    object ** end = it + lean_closure_num_fixed(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanArray: {
-                    object ** it  = lean_array_cptr(o);
-                    object ** end = it + lean_array_size(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanThunk:
-                    if (object * c = lean_to_thunk(o)->m_closure) todo.push_back(c);
-                    if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
-                    break;
-                case LeanRef:
-                    if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
-                    break;
-                default:
-                    lean_unreachable();
-                    break;
-                }
+        return true;
+    }
+    static void visit_external(object * o) {
+        object * fn = lean_alloc_closure((void*)mark_persistent_fn, 1, 0);
+        lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
+        lean_dec(fn);
+    }
+};
+
+struct mark_mt_fns {
+    static mark_counters & counters() { return get_mark_counters().m_mt; }
+    static bool should_visit(object * o) { return !lean_is_scalar(o) && lean_is_st(o); }
+    static bool claim(object * o, bool concurrent) {
+        if (concurrent) {
+            int rc = std::atomic_load_explicit(lean_get_rc_mt_addr(o), std::memory_order_relaxed);
+            while (rc > 0) {
+                if (std::atomic_compare_exchange_weak_explicit(lean_get_rc_mt_addr(o), &rc, -rc,
+                                                               std::memory_order_relaxed, std::memory_order_relaxed))
+                    return true;
             }
+            return false;
+        } else {
+            o->m_rc = -o->m_rc;
+            return true;
         }
     }
+    static void visit_external(object * o) {
+        object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
+        lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
+        lean_dec(fn);
+    }
+};
+
+/* Mark `o` if it has not been marked yet, and push its children that must be visited into `todo`.
+   Return true if `o` was marked by this call. */
+template<typename Fns>
+static inline bool mark_object(object * o, buffer<object*> & todo, bool concurrent) {
+    if (!Fns::should_visit(o) || !Fns::claim(o, concurrent))
+        return false;
+    auto push = [&](object * c) { if (Fns::should_visit(c)) todo.push_back(c); };
+    uint8_t tag = lean_ptr_tag(o);
+    if (tag <= LeanMaxCtorTag) {
+        object ** it  = lean_ctor_obj_cptr(o);
+        object ** end = it + lean_ctor_num_objs(o);
+        for (; it != end; ++it) push(*it);
+    } else {
+        switch (tag) {
+        case LeanScalarArray:
+        case LeanString:
+        case LeanMPZ:
+            break;
+        case LeanExternal:
+            Fns::visit_external(o);
+            break;
+        case LeanTask:
+            push(lean_task_get(o));
+            break;
+        case LeanClosure: {
+            object ** it  = lean_closure_arg_cptr(o);
+            object ** end = it + lean_closure_num_fixed(o);
+            for (; it != end; ++it) push(*it);
+            break;
+        }
+        case LeanArray: {
+            object ** it  = lean_array_cptr(o);
+            object ** end = it + lean_array_size(o);
+            for (; it != end; ++it) push(*it);
+            break;
+        }
+        case LeanThunk:
+            if (object * c = lean_to_thunk(o)->m_closure) push(c);
+            if (object * v = lean_to_thunk(o)->m_value) push(v);
+            break;
+        case LeanRef:
+            if (object * v = lean_to_ref(o)->m_value) push(v);
+            break;
+        default:
+            lean_unreachable();
+            break;
+        }
+    }
+    return true;
 }
 
-// =======================================
-// Mark MT
+#if defined(LEAN_MULTI_THREAD)
+/* Number of task manager workers that may help with a parallel marking, see `parallel_marker::mark`. */
+static unsigned get_num_mark_helpers();
+
+/* Work sharing state of a parallel marking. Threads with a large `todo` stack donate chunks
+   of it when other threads are idle. Helpers run as tasks, and join the marking when they start;
+   the marking is complete when all threads that joined are idle and there are no chunks left.
+   The state is freed by the last of the caller and the helper tasks, since helper tasks may only
+   start after the marking is complete. */
+template<typename Fns>
+class parallel_marker {
+    mutex                                m_mutex;
+    condition_variable                   m_cv;
+    std::vector<std::vector<object *>>   m_chunks;
+    unsigned                             m_num_threads{1};
+    std::atomic<unsigned>                m_num_idle{0};
+    bool                                 m_done{false};
+    std::atomic<size_t>                  m_num_marked{0};
+    std::atomic<unsigned>                m_rc;
+
+    void share(buffer<object*> & todo) {
+        size_t sz = todo.size();
+        std::vector<object *> chunk(todo.begin() + (sz - LEAN_PARALLEL_MARK_CHUNK), todo.end());
+        todo.shrink(sz - LEAN_PARALLEL_MARK_CHUNK);
+        lock_guard<mutex> lock(m_mutex);
+        m_chunks.push_back(std::move(chunk));
+        m_cv.notify_one();
+    }
+
+    bool get_chunk(buffer<object*> & todo) {
+        unique_lock<mutex> lock(m_mutex);
+        m_num_idle++;
+        while (m_chunks.empty()) {
+            if (m_done)
+                return false;
+            if (m_num_idle == m_num_threads) {
+                m_done = true;
+                m_cv.notify_all();
+                return false;
+            }
+            m_cv.wait(lock);
+        }
+        m_num_idle--;
+        todo.append(m_chunks.back());
+        m_chunks.pop_back();
+        return true;
+    }
 
-extern "C" void lean_mark_mt(object * o);
+    static obj_res helper_fn(obj_arg m, obj_arg) {
+        parallel_marker * marker = reinterpret_cast<parallel_marker *>(lean_unbox_usize(m));
+        lean_dec(m);
+        if (marker->join()) {
+            buffer<object*> todo;
+            marker->run(todo);
+        }
+        marker->release();
+        return lean_box(0);
+    }
 
-static obj_res mark_mt_fn(obj_arg o) {
-    lean_mark_mt(o);
-    lean_dec(o);
-    return lean_box(0);
-}
+    /* Return false if the marking is already complete. */
+    bool join() {
+        lock_guard<mutex> lock(m_mutex);
+        if (m_done)
+            return false;
+        m_num_threads++;
+        return true;
+    }
 
-extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
-#ifndef LEAN_MULTI_THREAD
-    return;
+    void release() {
+        if (m_rc.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    void run(buffer<object*> & todo) {
+        flet<bool> concurrent(g_marking_concurrently, true);
+        do {
+            size_t num_marked = 0;
+            while (!todo.empty()) {
+                object * o = todo.back();
+                todo.pop_back();
+                if (mark_object<Fns>(o, todo, true))
+                    num_marked++;
+                if (todo.size() >= 2 * LEAN_PARALLEL_MARK_CHUNK && m_num_idle.load(std::memory_order_relaxed) > 0)
+                    share(todo);
+            }
+            // before becoming idle, since the marking may be complete afterwards
+            m_num_marked += num_marked;
+        } while (get_chunk(todo));
+    }
+
+    explicit parallel_marker(unsigned num_helpers):m_rc(num_helpers + 1) {}
+
+public:
+    /* Continue marking `todo` with the help of `num_helpers` tasks, return the number of objects marked. */
+    static size_t mark(buffer<object*> & todo, unsigned num_helpers) {
+        parallel_marker * marker = new parallel_marker(num_helpers);
+        for (unsigned i = 0; i < num_helpers; i++) {
+            object * c = lean_alloc_closure((void*)helper_fn, 2, 1);
+            lean_closure_set(c, 0, lean_box_usize(reinterpret_cast<size_t>(marker)));
+            lean_dec(lean_task_spawn_core(c, 0, /* keep_alive */ true));
+        }
+        marker->run(todo);
+        size_t num_marked = marker->m_num_marked;
+        marker->release();
+        return num_marked;
+    }
+};
 #endif
-    if (lean_is_scalar(o) || !lean_is_st(o)) return;
 
+template<typename Fns>
+static void mark_core(object * o) {
+    if (!Fns::should_visit(o))
+        return;
+    // the marked objects may be freed by other threads from now on
+    complete_alloc_sample();
+    bool concurrent = g_marking_concurrently;
+    bool parallel   = false;
+    bool tried_parallel = false;
+    size_t num_marked = 0;
     buffer<object*> todo;
     todo.push_back(o);
     while (!todo.empty()) {
         object * o = todo.back();
         todo.pop_back();
-        if (!lean_is_scalar(o) && lean_is_st(o)) {
-            o->m_rc = -o->m_rc;
-            uint8_t tag = lean_ptr_tag(o);
-            if (tag <= LeanMaxCtorTag) {
-                object ** it  = lean_ctor_obj_cptr(o);
-                object ** end = it + lean_ctor_num_objs(o);
-                for (; it != end; ++it) todo.push_back(*it);
-            } else {
-                switch (tag) {
-                case LeanScalarArray:
-                case LeanString:
-                case LeanMPZ:
-                    break;
-                case LeanExternal: {
-                    object * fn = lean_alloc_closure((void*)mark_mt_fn, 1, 0);
-                    lean_to_external(o)->m_class->m_foreach(lean_to_external(o)->m_data, fn);
-                    lean_dec(fn);
-                    break;
-                }
-                case LeanTask:
-                    todo.push_back(lean_task_get(o));
-                    break;
-                case LeanClosure: {
-                    object ** it  = lean_closure_arg_cptr(o);
-                    object ** end = it + lean_closure_num_fixed(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanArray: {
-                    object ** it  = lean_array_cptr(o);
-                    object ** end = it + lean_array_size(o);
-                    for (; it != end; ++it) todo.push_back(*it);
-                    break;
-                }
-                case LeanThunk:
-                    if (object * c = lean_to_thunk(o)->m_closure) todo.push_back(c);
-                    if (object * v = lean_to_thunk(o)->m_value) todo.push_back(v);
-                    break;
-                case LeanRef:
-                    if (object * v = lean_to_ref(o)->m_value) todo.push_back(v);
-                    break;
-                default:
-                    lean_unreachable();
-                    break;
-                }
+        if (mark_object<Fns>(o, todo, concurrent))
+            num_marked++;
+#if defined(LEAN_MULTI_THREAD)
+        if (LEAN_UNLIKELY(num_marked >= LEAN_PARALLEL_MARK_THRESHOLD) && !tried_parallel && !concurrent &&
+            todo.size() >= LEAN_PARALLEL_MARK_CHUNK) {
+            tried_parallel = true;
+            if (unsigned num_helpers = get_num_mark_helpers()) {
+                num_marked += parallel_marker<Fns>::mark(todo, num_helpers);
+                parallel = true;
             }
         }
+#endif
     }
+    Fns::counters().add(num_marked, parallel);
+}
+
+extern "C" LEAN_EXPORT void lean_mark_persistent(object * o) {
+    mark_core<mark_persistent_fns>(o);
+}
+
+extern "C" LEAN_EXPORT void lean_mark_mt(object * o) {
+#ifndef LEAN_MULTI_THREAD
+    return;
+#endif
+    mark_core<mark_mt_fns>(o);
+}
+
+static void set_mark_stats(object * r, unsigned i, mark_counters mark_counter_stripe::* field) {
+    uint64_t num_calls = 0, num_marked = 0, max_marked = 0, num_parallel = 0;
+    for (mark_counter_stripe const & stripe : g_mark_counters) {
+        mark_counters const & c = stripe.*field;
+        num_calls    += c.m_num_calls.load(std::memory_order_relaxed);
+        num_marked   += c.m_num_marked.load(std::memory_order_relaxed);
+        max_marked    = std::max<uint64_t>(max_marked, c.m_max_marked.load(std::memory_order_relaxed));
+        num_parallel += c.m_num_parallel.load(std::memory_order_relaxed);
+    }
+    cnstr_set(r, i,     lean_uint64_to_nat(num_calls));
+    cnstr_set(r, i + 1, lean_uint64_to_nat(num_marked));
+    cnstr_set(r, i + 2, lean_uint64_to_nat(max_marked));
+    cnstr_set(r, i + 3, lean_uint64_to_nat(num_parallel));
+}
+
+/* getMarkStats : BaseIO MarkStats */
+extern "C" LEAN_EXPORT obj_res lean_io_get_mark_stats(obj_arg) {
+    object * r = alloc_cnstr(0, 8, 0);
+    set_mark_stats(r, 0, &mark_counter_stripe::m_mt);
+    set_mark_stats(r, 4, &mark_counter_stripe::m_persistent);
+    return io_result_mk_ok(r);
 }
 
 // =======================================
@@ -577,35 +998,213 @@ struct scoped_current_task_object : flet<lean_task_object *> {
     scoped_current_task_object(lean_task_object * t):flet(g_current_task_object, t) {}
 };
 
+/* Per-worker task queues, one Chase-Lev deque per priority lane. Only the owning worker pushes and pops,
+   all other workers may steal. */
+struct task_worker_queues {
+    task_deque<lean_task_object> m_lanes[LEAN_MAX_PRIO+1];
+};
+
+/* Queues of the current standard worker thread, or `nullptr` if the current thread is not one. */
+LEAN_THREAD_PTR(task_worker_queues, g_worker_queues);
+
+/* Tasks are mapped to a fixed number of wait slots by address, similar to futex hash buckets.
+   A slot's mutex protects the state transitions (see `lean_task_object`) of all tasks mapped to it,
+   and threads waiting for a task park on the slot's condition variable. */
+#define LEAN_NUM_TASK_WAIT_SLOTS 256
+
+struct task_wait_slot {
+    mutex              m_mutex;
+    condition_variable m_cv;
+};
+
+/* Event recorded when task tracing is enabled via `LEAN_TASK_TRACE`. Timestamps are in nanoseconds
+   since the task manager was created. Phases follow the Chrome trace event format: 'X' is a
+   complete event from `m_begin` to `m_end`, 'i' an instant event, and 'C' a counter sample. */
+struct task_trace_event {
+    char const *       m_name;
+    lean_task_object * m_task;
+    uint64_t           m_begin;
+    uint64_t           m_end;
+    unsigned           m_arg;
+    char               m_phase;
+};
+
+/* Events of a single thread. Only that thread appends to it; the buffers are written out when the
+   task manager is finalized. */
+struct task_trace_buffer {
+    unsigned                      m_tid;
+    std::vector<task_trace_event> m_events;
+};
+
+LEAN_THREAD_PTR(task_trace_buffer, g_task_trace_buffer);
+/* Identifies the task manager `g_task_trace_buffer` belongs to. */
+LEAN_THREAD_VALUE(unsigned, g_task_trace_generation, 0);
+static std::atomic<unsigned> g_next_task_trace_generation(1);
+
 class task_manager {
+    /* Protects the worker counters when workers exit. */
     mutex                                         m_mutex;
-    unsigned                                      m_num_std_workers{0};
-    unsigned                                      m_idle_std_workers{0};
+    std::atomic<unsigned>                         m_num_std_workers{0};
+    std::atomic<unsigned>                         m_idle_std_workers{0};
     unsigned                                      m_max_std_workers{0};
-    unsigned                                      m_num_dedicated_workers{0};
-    std::deque<lean_task_object *>                m_queues[LEAN_MAX_PRIO+1];
-    unsigned                                      m_queues_size{0};
-    unsigned                                      m_max_prio{0};
+    std::atomic<unsigned>                         m_num_dedicated_workers{0};
+    std::unique_ptr<task_worker_queues[]>         m_worker_queues;
+    /* Queues for tasks enqueued by threads that are not standard workers, protected by `m_shared_mutex`. */
+    mutex                                         m_shared_mutex;
+    std::deque<lean_task_object *>                m_shared_queues[LEAN_MAX_PRIO+1];
+    /* Number of queued tasks, in total and per priority. They are incremented after a task has been
+       pushed and decremented after it has been removed, so they may briefly overapproximate. */
+    std::atomic<unsigned>                         m_queues_size{0};
+    std::atomic<unsigned>                         m_prio_size[LEAN_MAX_PRIO+1];
+    mutex                                         m_sleep_mutex;
+    std::atomic<unsigned>                         m_sleeping_std_workers{0};
     condition_variable                            m_queue_cv;
-    condition_variable                            m_task_finished_cv;
     condition_variable                            m_worker_finished_cv;
-    bool                                          m_shutting_down{false};
-
-    lean_task_object * dequeue() {
-        lean_assert(m_queues_size != 0);
-        std::deque<lean_task_object *> & q = m_queues[m_max_prio];
-        lean_assert(!q.empty());
-        lean_task_object * result      = q.front();
-        q.pop_front();
-        m_queues_size--;
-        if (q.empty()) {
-            while (m_max_prio > 0) {
-                --m_max_prio;
-                if (!m_queues[m_max_prio].empty())
+    task_wait_slot                                m_wait_slots[LEAN_NUM_TASK_WAIT_SLOTS];
+    /* `IO.waitAny` may wait for several tasks, so it parks on a separate condition variable
+       that is only notified if there are such waiters. */
+    mutex                                         m_wait_any_mutex;
+    condition_variable                            m_wait_any_cv;
+    std::atomic<unsigned>                         m_wait_any_waiters{0};
+    std::atomic<bool>                             m_shutting_down{false};
+    /* Scheduler counters reported by `IO.getTaskStats`, updated with relaxed ordering. */
+    std::atomic<uint64_t>                         m_num_enqueued{0};
+    std::atomic<uint64_t>                         m_num_executed{0};
+    std::atomic<uint64_t>                         m_num_steals{0};
+    std::atomic<uint64_t>                         m_num_waits{0};
+    std::atomic<unsigned>                         m_max_queues_size{0};
+    /* Task tracing, enabled if `m_trace_file` is not empty. */
+    std::string                                   m_trace_file;
+    unsigned                                      m_trace_generation{0};
+    chrono::steady_clock::time_point              m_trace_start;
+    mutex                                         m_trace_mutex;
+    std::vector<std::unique_ptr<task_trace_buffer>> m_trace_buffers;
+
+    bool tracing() const {
+        return !m_trace_file.empty();
+    }
+
+    uint64_t trace_now() const {
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_trace_start).count();
+    }
+
+    task_trace_buffer & get_trace_buffer() {
+        if (g_task_trace_generation != m_trace_generation) {
+            lock_guard<mutex> lock(m_trace_mutex);
+            m_trace_buffers.emplace_back(new task_trace_buffer());
+            m_trace_buffers.back()->m_tid = m_trace_buffers.size();
+            g_task_trace_buffer     = m_trace_buffers.back().get();
+            g_task_trace_generation = m_trace_generation;
+        }
+        return *g_task_trace_buffer;
+    }
+
+    void trace(char phase, char const * name, lean_task_object * t, uint64_t begin, uint64_t end, unsigned arg) {
+        get_trace_buffer().m_events.push_back(task_trace_event { name, t, begin, end, arg, phase });
+    }
+
+    /* Write all recorded events as a Chrome trace event / Perfetto JSON file. Must only be called
+       after all workers have finished. */
+    void write_trace() {
+        std::ofstream out(m_trace_file);
+        if (!out) {
+            std::cerr << "failed to write task trace to '" << m_trace_file << "'\n";
+            return;
+        }
+        auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        out << std::fixed;
+        out.precision(3);
+        for (std::unique_ptr<task_trace_buffer> const & b : m_trace_buffers) {
+            if (!first) out << ",\n";
+            first = false;
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << b->m_tid
+                << ",\"args\":{\"name\":\"thread " << b->m_tid << "\"}}";
+            for (task_trace_event const & e : b->m_events) {
+                out << ",\n{\"name\":\"" << e.m_name << "\",\"cat\":\"task\",\"ph\":\"" << e.m_phase
+                    << "\",\"pid\":0,\"tid\":" << b->m_tid << ",\"ts\":" << us(e.m_begin);
+                switch (e.m_phase) {
+                case 'X':
+                    out << ",\"dur\":" << us(e.m_end - e.m_begin);
+                    break;
+                case 'i':
+                    out << ",\"s\":\"t\"";
                     break;
+                }
+                if (e.m_phase == 'C')
+                    out << ",\"args\":{\"" << e.m_name << "\":" << e.m_arg << "}}";
+                else
+                    out << ",\"args\":{\"task\":\"" << static_cast<void *>(e.m_task) << "\",\"prio\":" << e.m_arg << "}}";
             }
         }
-        return result;
+        out << "\n]}\n";
+    }
+
+    lean_task_object * steal_from(unsigned idx, unsigned prio) {
+        unsigned n = std::min(m_num_std_workers.load(), m_max_std_workers);
+        for (unsigned i = 1; i <= n; i++) {
+            task_deque<lean_task_object> & q = m_worker_queues[(idx + i) % n].m_lanes[prio];
+            while (true) {
+                lean_task_object * t = q.steal();
+                if (t != task_deque<lean_task_object>::abort()) {
+                    if (t) {
+                        m_num_steals.fetch_add(1, std::memory_order_relaxed);
+                        return t;
+                    }
+                    break;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    lean_task_object * dequeue_prio(unsigned idx, unsigned prio) {
+        lean_task_object * t = m_worker_queues[idx].m_lanes[prio].pop();
+        if (!t) {
+            lock_guard<mutex> lock(m_shared_mutex);
+            std::deque<lean_task_object *> & q = m_shared_queues[prio];
+            if (!q.empty()) {
+                t = q.front();
+                q.pop_front();
+            }
+        }
+        if (!t)
+            t = steal_from(idx, prio);
+        return t;
+    }
+
+    /* Take the task with the highest priority visible to worker `idx`: its own lane first,
+       then the shared queue, then the lanes of other workers. */
+    lean_task_object * dequeue(unsigned idx) {
+        for (unsigned prio = LEAN_MAX_PRIO + 1; prio-- > 0;) {
+            if (m_prio_size[prio].load() == 0)
+                continue;
+            if (lean_task_object * t = dequeue_prio(idx, prio)) {
+                m_prio_size[prio]--;
+                m_queues_size--;
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    void notify_worker() {
+        if (m_idle_std_workers.load() == 0) {
+            unsigned n = m_num_std_workers.load();
+            while (n < m_max_std_workers) {
+                if (m_num_std_workers.compare_exchange_weak(n, n + 1)) {
+                    spawn_worker(n);
+                    return;
+                }
+            }
+        }
+        /* Pairs with the increment of `m_sleeping_std_workers` before a worker re-checks
+           `m_queues_size` in `spawn_worker`; both are sequentially consistent. */
+        if (m_sleeping_std_workers.load() > 0) {
+            lock_guard<mutex> lock(m_sleep_mutex);
+            m_queue_cv.notify_one();
+        }
     }
 
     void enqueue_core(lean_task_object * t) {
@@ -615,16 +1214,32 @@ class task_manager {
             spawn_dedicated_worker(t);
             return;
         }
-        if (prio > m_max_prio)
-            m_max_prio = prio;
-        m_queues[prio].push_back(t);
-        m_queues_size++;
-        if (!m_idle_std_workers && m_num_std_workers < m_max_std_workers)
-            spawn_worker();
-        else
-            m_queue_cv.notify_one();
+        /* Count the task before publishing it, so that a worker taking it cannot decrement the counters first. */
+        m_prio_size[prio]++;
+        unsigned sz = ++m_queues_size;
+        if (task_worker_queues * q = g_worker_queues) {
+            q->m_lanes[prio].push(t);
+        } else {
+            lock_guard<mutex> lock(m_shared_mutex);
+            m_shared_queues[prio].push_back(t);
+        }
+        m_num_enqueued.fetch_add(1, std::memory_order_relaxed);
+        unsigned max_sz = m_max_queues_size.load(std::memory_order_relaxed);
+        while (sz > max_sz && !m_max_queues_size.compare_exchange_weak(max_sz, sz, std::memory_order_relaxed)) {}
+        if (tracing()) {
+            uint64_t now = trace_now();
+            trace('i', "enqueue", t, now, now, prio);
+            trace('C', "queue", nullptr, now, now, sz);
+        }
+        notify_worker();
     }
 
+    task_wait_slot & get_slot(lean_task_object * t) {
+        size_t h = reinterpret_cast<uintptr_t>(t) >> 4;
+        return m_wait_slots[(h ^ (h >> 8)) % LEAN_NUM_TASK_WAIT_SLOTS];
+    }
+
+    /* `lock` is the wait slot lock of `t`, it is released on return. */
     void deactivate_task_core(unique_lock<mutex> & lock, lean_task_object * t) {
         object * c              = t->m_imp->m_closure;
         lean_task_object * it   = t->m_imp->m_head_dep;
@@ -640,31 +1255,48 @@ class task_manager {
             it = next_it;
         }
         if (c) dec_ref(c);
-        lock.lock();
     }
 
-    void spawn_worker() {
-        m_num_std_workers++;
-        lthread([this]() {
+    void spawn_worker(unsigned idx) {
+        lthread([this, idx]() {
             save_stack_info(false);
-            unique_lock<mutex> lock(m_mutex);
+            if (unsigned num_nodes = numa_num_nodes()) {
+                /* Spread workers over NUMA nodes, and allocate their objects on their node. */
+                unsigned node = numa_node(idx % num_nodes);
+                numa_pin_current_thread(node);
+#ifdef LEAN_SMALL_ALLOCATOR
+                bind_thread_heap_to_numa_node(node);
+#endif
+            }
+            init_thread_deferred_rc();
+            g_worker_queues = &m_worker_queues[idx];
             m_idle_std_workers++;
             while (true) {
-                if (m_queues_size == 0) {
-                    if (m_shutting_down) {
-                        break;
+                lean_task_object * t = dequeue(idx);
+                if (!t) {
+                    flush_thread_deferred_rc();
+                    unique_lock<mutex> lock(m_sleep_mutex);
+                    if (m_queues_size.load() != 0) {
+                        /* a task is still being pushed or was taken concurrently */
+                        lock.unlock();
+                        this_thread::yield();
+                        continue;
                     }
-                    m_queue_cv.wait(lock);
+                    if (m_shutting_down)
+                        break;
+                    m_sleeping_std_workers++;
+                    m_queue_cv.wait(lock, [&]() { return m_queues_size.load() != 0 || m_shutting_down; });
+                    m_sleeping_std_workers--;
                     continue;
                 }
-
-                lean_task_object * t = dequeue();
                 m_idle_std_workers--;
-                run_task(lock, t);
+                run_task(t);
                 m_idle_std_workers++;
                 reset_heartbeat();
             }
             m_idle_std_workers--;
+            g_worker_queues = nullptr;
+            unique_lock<mutex> lock(m_mutex);
             m_num_std_workers--;
             m_worker_finished_cv.notify_all();
         });
@@ -675,32 +1307,43 @@ class task_manager {
         m_num_dedicated_workers++;
         lthread([this, t]() {
             save_stack_info(false);
+            /* No deferred reference counting here: dedicated tasks are usually long-running, and the worker would
+               only flush its pending decrements when it exits. */
+            run_task(t);
             unique_lock<mutex> lock(m_mutex);
-            run_task(lock, t);
             m_num_dedicated_workers--;
             m_worker_finished_cv.notify_all();
         });
         // see above
     }
 
-    void run_task(unique_lock<mutex> & lock, lean_task_object * t) {
+    void run_task(lean_task_object * t) {
+        unique_lock<mutex> lock(get_slot(t).m_mutex);
         lean_assert(t->m_imp);
         if (t->m_imp->m_deleted) {
+            lock.unlock();
             free_task(t);
             return;
         }
         reset_heartbeat();
         object * v = nullptr;
+        m_num_executed.fetch_add(1, std::memory_order_relaxed);
         {
             scoped_current_task_object scope_cur_task(t);
             object * c = t->m_imp->m_closure;
+            unsigned prio = t->m_imp->m_prio;
             t->m_imp->m_closure = nullptr;
             lock.unlock();
+            uint64_t start = tracing() ? trace_now() : 0;
             v = lean_apply_1(c, box(0));
+            if (tracing())
+                trace('X', "run", t, start, trace_now(), prio);
             // If deactivation was delayed by `m_keep_alive`, deactivate after the final execution (`v != nulltpr`)
             if (v != nullptr && t->m_imp->m_keep_alive) {
                 lean_dec_ref((lean_object*)t);
             }
+            if (v != nullptr)
+                mark_mt(v);
             lock.lock();
         }
         lean_assert(t->m_imp);
@@ -708,38 +1351,49 @@ class task_manager {
             lock.unlock();
             if (v) lean_dec(v);
             free_task(t);
-            lock.lock();
         } else if (v != nullptr) {
             lean_assert(t->m_imp->m_closure == nullptr);
-            resolve_core(t, v);
+            resolve_core(lock, t, v);
         } else {
             // `bind` task has not finished yet, re-add as dependency of nested task
+            lean_task_object * nested = lean_to_task(closure_arg_cptr(t->m_imp->m_closure)[0]);
             lock.unlock();
-            add_dep(lean_to_task(closure_arg_cptr(t->m_imp->m_closure)[0]), t);
-            lock.lock();
+            add_dep(nested, t);
         }
     }
 
-    void resolve_core(lean_task_object * t, object * v) {
-        handle_finished(t);
-        mark_mt(v);
-        t->m_value = v;
+    /* Publish `v` as the value of `t` and wake up only the threads parked on `t`'s wait slot.
+       `lock` is the wait slot lock of `t`, it is released on return. We must not access `t` after
+       releasing it since a woken up thread may free it. `v` must already be marked as MT. */
+    void resolve_core(unique_lock<mutex> & lock, lean_task_object * t, object * v) {
+        lean_task_imp * imp   = t->m_imp;
+        lean_task_object * it = imp->m_head_dep;
+        imp->m_head_dep       = nullptr;
+        t->m_imp              = nullptr;
+        t->m_value            = v;
+        get_slot(t).m_cv.notify_all();
+        lock.unlock();
+        notify_wait_any();
         /* After the task has been finished and we propagated
            dependecies, we can release `m_imp` and keep just the value */
-        free_task_imp(t->m_imp);
-        t->m_imp   = nullptr;
-        m_task_finished_cv.notify_all();
+        handle_finished(it, imp->m_canceled);
+        free_task_imp(imp);
     }
 
-    void handle_finished(lean_task_object * t) {
-        lean_task_object * it = t->m_imp->m_head_dep;
-        t->m_imp->m_head_dep = nullptr;
+    /* Enqueue the dependents `it->m_next_dep->...` of a task that just finished. */
+    void handle_finished(lean_task_object * it, bool canceled) {
         while (it) {
-            if (t->m_imp->m_canceled)
-                it->m_imp->m_canceled = true;
-            lean_task_object * next_it = it->m_imp->m_next_dep;
-            it->m_imp->m_next_dep = nullptr;
-            if (it->m_imp->m_deleted) {
+            lean_task_object * next_it;
+            bool deleted;
+            {
+                lock_guard<mutex> lock(get_slot(it).m_mutex);
+                if (canceled)
+                    it->m_imp->m_canceled = true;
+                next_it = it->m_imp->m_next_dep;
+                it->m_imp->m_next_dep = nullptr;
+                deleted = it->m_imp->m_deleted;
+            }
+            if (deleted) {
                 free_task(it);
             } else {
                 enqueue_core(it);
@@ -748,6 +1402,15 @@ class task_manager {
         }
     }
 
+    /* Pairs with the increment of `m_wait_any_waiters` in `wait_any`; both it and the store to
+       `m_value` in `resolve_core` are sequentially consistent. */
+    void notify_wait_any() {
+        if (m_wait_any_waiters.load() > 0) {
+            lock_guard<mutex> lock(m_wait_any_mutex);
+            m_wait_any_cv.notify_all();
+        }
+    }
+
     object * wait_any_check(object * task_list) {
         object * it = task_list;
         while (!is_scalar(it)) {
@@ -761,69 +1424,112 @@ class task_manager {
 
 public:
     task_manager(unsigned max_std_workers):
-        m_max_std_workers(max_std_workers) {
+        m_max_std_workers(max_std_workers),
+        m_worker_queues(new task_worker_queues[max_std_workers]) {
+        for (std::atomic<unsigned> & sz : m_prio_size)
+            sz = 0;
+#ifndef LEAN_EMSCRIPTEN
+        if (char const * fn = std::getenv("LEAN_TASK_TRACE")) {
+            m_trace_file       = fn;
+            m_trace_generation = g_next_task_trace_generation++;
+            m_trace_start      = chrono::steady_clock::now();
+        }
+#endif
     }
 
     ~task_manager() {
+        {
+            lock_guard<mutex> lock(m_sleep_mutex);
+            m_shutting_down = true;
+            m_queue_cv.notify_all();
+        }
         unique_lock<mutex> lock(m_mutex);
-        m_shutting_down = true;
-        m_queue_cv.notify_all();
         // wait for all workers to finish
         m_worker_finished_cv.wait(lock, [&]() { return m_num_std_workers + m_num_dedicated_workers == 0; });
+        if (tracing())
+            write_trace();
     }
 
     void enqueue(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
         enqueue_core(t);
     }
 
     void resolve(lean_task_object * t, object * v) {
-        unique_lock<mutex> lock(m_mutex);
+        mark_mt(v);
+        unique_lock<mutex> lock(get_slot(t).m_mutex);
         if (t->m_value) {
+            lock.unlock();
             dec(v);
             return;
         }
-        resolve_core(t, v);
+        resolve_core(lock, t, v);
     }
 
     void add_dep(lean_task_object * t1, lean_task_object * t2) {
         lean_assert(t2->m_value == nullptr);
-        if (t1->m_value) {
-            enqueue(t2);
-            return;
-        }
-        unique_lock<mutex> lock(m_mutex);
-        lean_assert(t2->m_value == nullptr);
-        if (t1->m_value) {
-            enqueue_core(t2);
-            return;
+        if (!t1->m_value) {
+            lock_guard<mutex> lock(get_slot(t1).m_mutex);
+            if (!t1->m_value) {
+                t2->m_imp->m_next_dep = t1->m_imp->m_head_dep;
+                t1->m_imp->m_head_dep = t2;
+                return;
+            }
         }
-        t2->m_imp->m_next_dep = t1->m_imp->m_head_dep;
-        t1->m_imp->m_head_dep = t2;
+        enqueue_core(t2);
     }
 
     void wait_for(lean_task_object * t) {
         if (t->m_value)
             return;
-        unique_lock<mutex> lock(m_mutex);
-        if (t->m_value)
-            return;
-        m_task_finished_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        m_num_waits.fetch_add(1, std::memory_order_relaxed);
+        uint64_t start = tracing() ? trace_now() : 0;
+        {
+            task_wait_slot & slot = get_slot(t);
+            unique_lock<mutex> lock(slot.m_mutex);
+            slot.m_cv.wait(lock, [&]() { return t->m_value != nullptr; });
+        }
+        if (tracing())
+            trace('X', "wait", t, start, trace_now(), 0);
+    }
+
+    void trace_spawn(lean_task_object * t) {
+        if (tracing()) {
+            uint64_t now = trace_now();
+            trace('i', "spawn", t, now, now, t->m_imp->m_prio);
+        }
+    }
+
+    /* See `IO.TaskStats`. */
+    object * get_stats() {
+        object * r = alloc_cnstr(0, 9, 0);
+        cnstr_set(r, 0, lean_unsigned_to_nat(m_num_std_workers.load()));
+        cnstr_set(r, 1, lean_unsigned_to_nat(m_idle_std_workers.load()));
+        cnstr_set(r, 2, lean_unsigned_to_nat(m_num_dedicated_workers.load()));
+        cnstr_set(r, 3, lean_unsigned_to_nat(m_queues_size.load()));
+        cnstr_set(r, 4, lean_unsigned_to_nat(m_max_queues_size.load()));
+        cnstr_set(r, 5, lean_uint64_to_nat(m_num_enqueued.load(std::memory_order_relaxed)));
+        cnstr_set(r, 6, lean_uint64_to_nat(m_num_executed.load(std::memory_order_relaxed)));
+        cnstr_set(r, 7, lean_uint64_to_nat(m_num_steals.load(std::memory_order_relaxed)));
+        cnstr_set(r, 8, lean_uint64_to_nat(m_num_waits.load(std::memory_order_relaxed)));
+        return r;
     }
 
     object * wait_any(object * task_list) {
         if (object * t = wait_any_check(task_list))
             return t;
-        unique_lock<mutex> lock(m_mutex);
+        unique_lock<mutex> lock(m_wait_any_mutex);
+        m_wait_any_waiters++;
         while (true) {
-            if (object * t = wait_any_check(task_list))
+            if (object * t = wait_any_check(task_list)) {
+                m_wait_any_waiters--;
                 return t;
-            m_task_finished_cv.wait(lock);
+            }
+            m_wait_any_cv.wait(lock);
         }
     }
 
     void deactivate_task(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
+        unique_lock<mutex> lock(get_slot(t).m_mutex);
         if (object * v = t->m_value) {
             lean_assert(t->m_imp == nullptr);
             lock.unlock();
@@ -837,7 +1543,7 @@ public:
     }
 
     void cancel(lean_task_object * t) {
-        unique_lock<mutex> lock(m_mutex);
+        lock_guard<mutex> lock(get_slot(t).m_mutex);
         if (t->m_imp)
             t->m_imp->m_canceled = true;
     }
@@ -845,10 +1551,22 @@ public:
     bool shutting_down() const {
         return m_shutting_down;
     }
+
+    unsigned max_std_workers() const {
+        return m_max_std_workers;
+    }
 };
 
 static task_manager * g_task_manager = nullptr;
 
+#if defined(LEAN_MULTI_THREAD)
+static unsigned get_num_mark_helpers() {
+    if (g_task_manager == nullptr || g_task_manager->shutting_down())
+        return 0;
+    return std::min(g_task_manager->max_std_workers(), static_cast<unsigned>(LEAN_MAX_PARALLEL_MARK_THREADS - 1));
+}
+#endif
+
 extern "C" LEAN_EXPORT void lean_init_task_manager_using(unsigned num_workers) {
     lean_assert(g_task_manager == nullptr);
 #if defined(LEAN_MULTI_THREAD)
@@ -919,6 +1637,7 @@ static lean_task_object * alloc_task(obj_arg c, unsigned prio, bool keep_alive)
     o->m_imp   = alloc_task_imp(c, prio, keep_alive);
     if (keep_alive)
         lean_inc_ref((lean_object*)o);
+    g_task_manager->trace_spawn(o);
     return o;
 }
 
@@ -1044,6 +1763,16 @@ extern "C" LEAN_EXPORT obj_res lean_io_promise_resolve(obj_arg value, b_obj_arg
     return io_result_mk_ok(box(0));
 }
 
+/* getTaskStats : BaseIO TaskStats */
+extern "C" LEAN_EXPORT obj_res lean_io_get_task_stats(obj_arg) {
+    if (g_task_manager)
+        return io_result_mk_ok(g_task_manager->get_stats());
+    object * r = alloc_cnstr(0, 9, 0);
+    for (unsigned i = 0; i < 9; i++)
+        cnstr_set(r, i, box(0));
+    return io_result_mk_ok(r);
+}
+
 // =======================================
 // Natural numbers
 
@@ -2261,6 +2990,21 @@ extern "C" LEAN_EXPORT lean_external_class * lean_register_external_class(lean_e
 }
 
 void initialize_object() {
+#ifndef LEAN_EMSCRIPTEN
+    if (char const * n = std::getenv("LEAN_DEFERRED_RC")) {
+        int v = atoi(n);
+        g_deferred_rc_capacity = v > 0 ? v : 0;
+    }
+#if defined(LEAN_MULTI_THREAD) && !defined(LEAN_LAZY_RC)
+    if (char const * n = std::getenv("LEAN_BACKGROUND_FREE")) {
+        int v = atoi(n);
+        if (v > 0) {
+            g_free_budget = v;
+            g_reclaimer   = new reclaimer();
+        }
+    }
+#endif
+#endif
     g_ext_classes       = new std::vector<external_object_class*>();
     g_ext_classes_mutex = new mutex();
     g_array_empty       = lean_alloc_array(0, 0);
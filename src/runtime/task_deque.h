@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include "runtime/debug.h"
+
+namespace lean {
+/**
+   \brief Chase-Lev work-stealing deque of pointers.
+
+   The owner thread pushes and pops at the bottom (LIFO), any other thread may
+   steal from the top (FIFO). The implementation follows "Correct and Efficient
+   Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+
+   Buffers replaced by `grow` are retired but only released by the destructor,
+   since a concurrent thief may still be reading from them. */
+template<typename T>
+class task_deque {
+    struct buffer {
+        int64_t                       m_capacity;
+        std::atomic<T *> *            m_data;
+        explicit buffer(int64_t capacity):m_capacity(capacity), m_data(new std::atomic<T *>[capacity]) {}
+        ~buffer() { delete[] m_data; }
+        T * get(int64_t i) const { return m_data[i & (m_capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T * v) { m_data[i & (m_capacity - 1)].store(v, std::memory_order_relaxed); }
+    };
+
+    std::atomic<int64_t>  m_top{0};
+    std::atomic<int64_t>  m_bottom{0};
+    std::atomic<buffer *> m_buffer;
+    std::vector<buffer *> m_retired;
+
+    buffer * grow(buffer * old, int64_t bottom, int64_t top) {
+        buffer * b = new buffer(old->m_capacity * 2);
+        for (int64_t i = top; i < bottom; i++)
+            b->put(i, old->get(i));
+        m_retired.push_back(old);
+        m_buffer.store(b, std::memory_order_release);
+        return b;
+    }
+
+public:
+    /** \brief Result of `steal` when another thread won the race for the top element. */
+    static T * abort() { return reinterpret_cast<T *>(static_cast<uintptr_t>(1)); }
+
+    explicit task_deque(int64_t initial_capacity = 256):
+        m_buffer(new buffer(initial_capacity)) {
+        lean_assert((initial_capacity & (initial_capacity - 1)) == 0);
+    }
+
+    ~task_deque() {
+        delete m_buffer.load(std::memory_order_relaxed);
+        for (buffer * b : m_retired)
+            delete b;
+    }
+
+    task_deque(task_deque const &) = delete;
+    task_deque & operator=(task_deque const &) = delete;
+
+    /** \brief Push `v` at the bottom. Must only be called by the owner thread. */
+    void push(T * v) {
+        int64_t b  = m_bottom.load(std::memory_order_relaxed);
+        int64_t t  = m_top.load(std::memory_order_acquire);
+        buffer * a = m_buffer.load(std::memory_order_relaxed);
+        if (b - t > a->m_capacity - 1)
+            a = grow(a, b, t);
+        a->put(b, v);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    /** \brief Pop from the bottom, or return `nullptr` if the deque is empty.
+        Must only be called by the owner thread. */
+    T * pop() {
+        int64_t b  = m_bottom.load(std::memory_order_relaxed) - 1;
+        buffer * a = m_buffer.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t  = m_top.load(std::memory_order_relaxed);
+        T * r      = nullptr;
+        if (t <= b) {
+            r = a->get(b);
+            if (t == b) {
+                /* last element, race against thieves */
+                if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    r = nullptr;
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        } else {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return r;
+    }
+
+    /** \brief Steal from the top. Returns `nullptr` if the deque is empty, and `abort()` if
+        the element was taken by a concurrent `pop` or `steal`. May be called by any thread. */
+    T * steal() {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t < b) {
+            buffer * a = m_buffer.load(std::memory_order_acquire);
+            T * r = a->get(t);
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return abort();
+            return r;
+        }
+        return nullptr;
+    }
+
+    /** \brief Approximate number of elements, for statistics and heuristics only. */
+    int64_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+};
+}
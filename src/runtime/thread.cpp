@@ -7,11 +7,21 @@ Author: Leonardo de Moura
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
 #ifdef LEAN_WINDOWS
 #include <windows.h>
 #else
 #include <pthread.h>
 #endif
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 #include <lean/config.h>
 #include "runtime/thread.h"
 #include "runtime/interrupt.h"
@@ -310,4 +320,100 @@ void finalize_thread() {
     finalize_thread_local_reset_fns();
 }
 #endif
+
+#if defined(__linux__) && !defined(LEAN_EMSCRIPTEN)
+/* Parse a Linux cpu/node list such as `0-3,8-11` into `r`. Return false if `s` is malformed. */
+static bool parse_cpu_list(std::string const & s, std::vector<unsigned> & r) {
+    char const * it = s.c_str();
+    while (*it != 0 && *it != '\n') {
+        char * end;
+        errno = 0;
+        unsigned long lo = strtoul(it, &end, 10);
+        if (end == it || errno != 0)
+            return false;
+        unsigned long hi = lo;
+        if (*end == '-') {
+            it = end + 1;
+            hi = strtoul(it, &end, 10);
+            if (end == it || errno != 0 || hi < lo || hi - lo > 65536)
+                return false;
+        }
+        for (unsigned long k = lo; k <= hi; k++)
+            r.push_back(static_cast<unsigned>(k));
+        it = end;
+        if (*it == ',')
+            it++;
+        else if (*it != 0 && *it != '\n')
+            return false;
+    }
+    return true;
+}
+
+struct numa_node_cpus {
+    unsigned              m_node;
+    std::vector<unsigned> m_cpus;
+};
+
+/* NUMA nodes that have CPUs, empty if NUMA support is disabled or the system topology cannot be read.
+   Memory-only nodes are skipped, since we only place worker threads and their heaps. */
+static std::vector<numa_node_cpus> const & get_numa_nodes() {
+    static std::vector<numa_node_cpus> * nodes = []() {
+        auto * r = new std::vector<numa_node_cpus>();
+        char const * e = std::getenv("LEAN_NUMA");
+        if (!e || std::string(e) == "0")
+            return r;
+        std::ifstream has_cpu("/sys/devices/system/node/has_cpu");
+        std::string line;
+        std::vector<unsigned> node_ids;
+        if (!std::getline(has_cpu, line) || !parse_cpu_list(line, node_ids))
+            return r;
+        for (unsigned node : node_ids) {
+            std::ifstream cpus("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string cpu_line;
+            numa_node_cpus n{node, {}};
+            if (!std::getline(cpus, cpu_line) || !parse_cpu_list(cpu_line, n.m_cpus)) {
+                r->clear();
+                return r;
+            }
+            if (!n.m_cpus.empty())
+                r->push_back(std::move(n));
+        }
+        return r;
+    }();
+    return *nodes;
+}
+
+unsigned numa_num_nodes() {
+    return get_numa_nodes().size();
+}
+
+unsigned numa_node(unsigned i) {
+    return get_numa_nodes()[i].m_node;
+}
+
+int numa_current_node() {
+    unsigned cpu, node;
+    if (numa_num_nodes() == 0 || syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+        return -1;
+    return node;
+}
+
+void numa_pin_current_thread(unsigned node) {
+    for (numa_node_cpus const & n : get_numa_nodes()) {
+        if (n.m_node == node) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (unsigned cpu : n.m_cpus)
+                if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+            return;
+        }
+    }
+}
+#else
+unsigned numa_num_nodes() { return 0; }
+unsigned numa_node(unsigned) { lean_unreachable(); }
+int numa_current_node() { return -1; }
+void numa_pin_current_thread(unsigned) {}
+#endif
 }
@@ -246,4 +246,15 @@ void register_thread_local_reset_fn(std::function<void()> fn);
    We invoke this function before processing a command
    and before executing a task. */
 void reset_thread_local();
+
+/**
+   \brief Return the number of NUMA nodes with CPUs if NUMA aware allocation is enabled
+   (environment variable `LEAN_NUMA=1`, Linux only), and 0 otherwise. */
+unsigned numa_num_nodes();
+/** \brief Return the id of the `i`-th NUMA node with CPUs, `i < numa_num_nodes()`. */
+unsigned numa_node(unsigned i);
+/** \brief Return the NUMA node of the CPU executing the current thread, or -1 if unknown. */
+int numa_current_node();
+/** \brief Restrict the current thread to the CPUs of the given NUMA node. */
+void numa_pin_current_thread(unsigned node);
 }
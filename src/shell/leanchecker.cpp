@@ -0,0 +1,12 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+
+// The actual main function is in `util/checker.cpp` and compiled into `libleanshared`, see `lean.cpp`.
+
+extern "C" int lean_checker_main(int argc, char ** argv);
+
+int main(int argc, char ** argv) {
+    return lean_checker_main(argc, argv);
+}
@@ -0,0 +1,449 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "runtime/sstream.h"
+#include "runtime/thread.h"
+#include "runtime/object_ref.h"
+#include "util/io.h"
+#include "util/name_hash_map.h"
+#include "util/timeit.h"
+#include "kernel/environment.h"
+#include "kernel/kernel_exception.h"
+#include "kernel/replace_fn.h"
+#include "kernel/for_each_fn.h"
+#include "kernel/expr_eq_fn.h"
+#include "kernel/shared_cache.h"
+#include "library/util.h"
+#include "initialize/init.h"
+#include <getopt.h>
+
+/* Independent re-checker for .olean files.
+
+   All declarations of the import closure of the given modules are replayed through `environment::add` with
+   `check = true`, starting from an empty environment. Declarations are ordered by their dependencies. Inductive
+   declarations, the `Quot` declarations and mutual unsafe definitions are added and checked in this order, but the
+   remaining declarations are added without checks, and each of them is checked in a task in the environment it has been
+   added to. Since this environment contains exactly the declarations preceding it, the result is the same as the one
+   of a sequential replay, but the checks run in parallel. */
+namespace lean {
+extern "C" object * lean_init_search_path(object * w);
+extern "C" object * lean_import_modules(object * imports, object * opts, uint32 trust_level, object * w);
+
+namespace {
+struct check_node {
+    declaration           m_decl;
+    // the declared constants, including the constructors and recursors generated for inductive declarations
+    std::vector<name>     m_names;
+    std::vector<unsigned> m_deps;
+    // written by the task checking the declaration, if any
+    second_duration       m_time{0};
+    std::string           m_error;
+};
+
+/* Describe the kernel exception being handled. */
+static std::string kernel_error_message() {
+    try {
+        throw;
+    } catch (unknown_constant_exception & ex) {
+        return (sstream() << "unknown constant '" << ex.get_name() << "'").str();
+    } catch (already_declared_exception & ex) {
+        return (sstream() << "already declared '" << ex.get_name() << "'").str();
+    } catch (definition_type_mismatch_exception &) {
+        return "declaration type mismatch";
+    } catch (declaration_has_metavars_exception &) {
+        return "declaration has metavariables";
+    } catch (declaration_has_free_vars_exception &) {
+        return "declaration has free variables";
+    } catch (function_expected_exception &) {
+        return "function expected";
+    } catch (type_expected_exception &) {
+        return "type expected";
+    } catch (def_type_mismatch_exception & ex) {
+        return (sstream() << "type mismatch at let-declaration '" << ex.get_name() << "'").str();
+    } catch (expr_type_mismatch_exception &) {
+        return "type mismatch";
+    } catch (app_type_mismatch_exception &) {
+        return "application type mismatch";
+    } catch (invalid_proj_exception &) {
+        return "invalid projection";
+    } catch (throwable & ex) {
+        return ex.what();
+    }
+}
+
+/* Task checking the declaration of a node with the given shared cache, see `checker::replay`. */
+static obj_res check_node_fn(obj_arg env, obj_arg node_ptr, obj_arg cache_ptr, obj_arg) {
+    check_node & node = *reinterpret_cast<check_node *>(unbox_size_t(node_ptr));
+    dec(node_ptr);
+    scope_shared_kernel_cache scope_cache(reinterpret_cast<shared_kernel_cache *>(unbox_size_t(cache_ptr)));
+    dec(cache_ptr);
+    environment e(env);
+    auto start = std::chrono::steady_clock::now();
+    try {
+        e.add(node.m_decl, true);
+    } catch (throwable &) {
+        node.m_error = kernel_error_message();
+    }
+    node.m_time = std::chrono::steady_clock::now() - start;
+    return box(0);
+}
+
+/* Tasks spawned by `checker::replay`. They write to the nodes of the checker and use its shared cache, so they are
+   waited for before these are destroyed, including when the replay stops early or throws. */
+class check_tasks {
+    std::vector<object_ref> m_tasks;
+public:
+    ~check_tasks() { wait(); }
+    void push_back(object * t) { m_tasks.push_back(object_ref(t)); }
+    void wait() {
+        for (object_ref const & t : m_tasks)
+            lean_task_get(t.raw());
+        m_tasks.clear();
+    }
+};
+
+class checker {
+    environment             m_imported;
+    std::vector<check_node> m_nodes;
+    name_hash_map<unsigned> m_node_of;
+
+    unsigned mk_node(declaration const & d) {
+        m_nodes.push_back(check_node());
+        m_nodes.back().m_decl = d;
+        return m_nodes.size() - 1;
+    }
+
+    void set_node(name const & n, unsigned i) {
+        m_node_of[n] = i;
+        m_nodes[i].m_names.push_back(n);
+    }
+
+    void mk_inductive_node(inductive_val const & v) {
+        buffer<inductive_type> types;
+        for (name const & n : v.get_all()) {
+            inductive_val iv = m_imported.get(n).to_inductive_val();
+            buffer<constructor> cnstrs;
+            for (name const & c : iv.get_cnstrs())
+                cnstrs.push_back(constructor(c, m_imported.get(c).get_type()));
+            types.push_back(inductive_type(n, iv.to_constant_val().get_type(), constructors(cnstrs)));
+        }
+        unsigned i = mk_node(mk_inductive_decl(v.to_constant_val().get_lparams(), nat(v.get_nparams()),
+                                               inductive_types(types), v.is_unsafe()));
+        for (inductive_type const & type : types) {
+            set_node(type.get_name(), i);
+            for (constructor const & c : type.get_cnstrs())
+                set_node(constructor_name(c), i);
+        }
+    }
+
+    void mk_mutual_node(definition_val const & v) {
+        buffer<definition_val> defs;
+        for (name const & n : v.get_all())
+            defs.push_back(m_imported.get(n).to_definition_val());
+        unsigned i = mk_node(declaration(mk_cnstr(static_cast<unsigned>(declaration_kind::MutualDefinition),
+                                                  definition_vals(defs))));
+        for (definition_val const & d : defs)
+            set_node(d.get_name(), i);
+    }
+
+    void mk_nodes() {
+        optional<unsigned> quot;
+        std::vector<recursor_val> recs;
+        m_imported.for_each_constant([&](constant_info const & info) {
+                name const & n = info.get_name();
+                if (m_node_of.find(n) != m_node_of.end())
+                    return;
+                switch (info.kind()) {
+                case constant_info_kind::Definition: {
+                    definition_val const & v = info.to_definition_val();
+                    if (v.get_safety() != definition_safety::safe && length(v.get_all()) > 1) {
+                        mk_mutual_node(v);
+                        return;
+                    }
+                    break;
+                }
+                case constant_info_kind::Quot:
+                    if (!quot)
+                        quot = mk_node(declaration(box(static_cast<unsigned>(declaration_kind::Quot))));
+                    set_node(n, *quot);
+                    return;
+                case constant_info_kind::Inductive:
+                    mk_inductive_node(info.to_inductive_val());
+                    return;
+                case constant_info_kind::Constructor:
+                    // added together with its inductive type
+                    return;
+                case constant_info_kind::Recursor:
+                    recs.push_back(info.to_recursor_val());
+                    return;
+                default:
+                    break;
+                }
+                // axioms, theorems, opaque and definitions have the same representation as their declaration
+                set_node(n, mk_node(declaration(static_cast<object_ref const &>(info))));
+            });
+        for (recursor_val const & v : recs) {
+            auto it = m_node_of.find(head(v.get_all()));
+            if (it == m_node_of.end())
+                throw exception(sstream() << "recursor '" << v.get_name() << "' does not belong to an inductive type");
+            set_node(v.get_name(), it->second);
+        }
+    }
+
+    void collect_deps(unsigned i, expr const & e) {
+        std::vector<unsigned> & deps = m_nodes[i].m_deps;
+        for_each(e, [&](expr const & e, unsigned) {
+                if (is_constant(e)) {
+                    auto it = m_node_of.find(const_name(e));
+                    if (it == m_node_of.end())
+                        throw exception(sstream() << "unknown constant '" << const_name(e) << "'");
+                    if (it->second != i)
+                        deps.push_back(it->second);
+                }
+                return true;
+            });
+    }
+
+    void collect_deps(unsigned i) {
+        for (name const & n : m_nodes[i].m_names) {
+            constant_info info = m_imported.get(n);
+            collect_deps(i, info.get_type());
+            if (info.has_value(true))
+                collect_deps(i, info.get_value(true));
+        }
+        std::vector<unsigned> & deps = m_nodes[i].m_deps;
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+    }
+
+    std::vector<unsigned> topological_order() const {
+        // 0: not visited, 1: being visited, 2: visited
+        std::vector<unsigned char> state(m_nodes.size(), 0);
+        std::vector<unsigned> order;
+        std::vector<std::pair<unsigned, unsigned>> todo;
+        for (unsigned root = 0; root < m_nodes.size(); root++) {
+            if (state[root])
+                continue;
+            state[root] = 1;
+            todo.emplace_back(root, 0);
+            while (!todo.empty()) {
+                unsigned i = todo.back().first;
+                unsigned & next = todo.back().second;
+                if (next < m_nodes[i].m_deps.size()) {
+                    unsigned dep = m_nodes[i].m_deps[next++];
+                    if (state[dep] == 1)
+                        throw exception(sstream() << "dependency cycle through '" << m_nodes[dep].m_names[0] << "'");
+                    if (state[dep] == 0) {
+                        state[dep] = 1;
+                        todo.emplace_back(dep, 0);
+                    }
+                } else {
+                    state[i] = 2;
+                    order.push_back(i);
+                    todo.pop_back();
+                }
+            }
+        }
+        return order;
+    }
+
+    /* Check that the constants generated by the inductive declaration of the node `i` match the imported ones. */
+    void check_generated(environment const & env, unsigned i) {
+        for (name const & n : m_nodes[i].m_names) {
+            constant_info stored = m_imported.get(n);
+            optional<constant_info> info = env.find(n);
+            bool ok = info && info->kind() == stored.kind() && info->get_lparams() == stored.get_lparams() &&
+                info->get_type() == stored.get_type();
+            if (ok && info->is_recursor()) {
+                recursor_rules const & rules = info->to_recursor_val().get_rules();
+                recursor_rules const & stored_rules = stored.to_recursor_val().get_rules();
+                ok = length(rules) == length(stored_rules) &&
+                    std::equal(rules.begin(), rules.end(), stored_rules.begin(), [](recursor_rule const & r1, recursor_rule const & r2) {
+                            return r1.get_cnstr() == r2.get_cnstr() && r1.get_rhs() == r2.get_rhs();
+                        });
+            }
+            if (!ok && m_nodes[i].m_error.empty())
+                m_nodes[i].m_error = (sstream() << "'" << n << "' does not match the constant generated by the kernel").str();
+        }
+    }
+
+public:
+    explicit checker(environment const & imported):m_imported(imported) {}
+
+    /* Replay the imported declarations. Return the number of failed declarations. */
+    unsigned replay(std::ostream & out, optional<std::string> const & report_fn, size_t cache_capacity) {
+        auto start = std::chrono::steady_clock::now();
+        mk_nodes();
+        for (unsigned i = 0; i < m_nodes.size(); i++)
+            collect_deps(i);
+        std::vector<unsigned> order = topological_order();
+        second_duration prepare_time = std::chrono::steady_clock::now() - start;
+
+        // trust level 0: every declaration is checked
+        unsigned trust_lvl = 0;
+        environment env(trust_lvl);
+        // the environments of the checks extend one another, so they can share a cache. It is installed in this
+        // thread for the declarations added here, and by each task for its own check.
+        std::unique_ptr<shared_kernel_cache> cache;
+        if (cache_capacity > 0)
+            cache.reset(new shared_kernel_cache(cache_capacity));
+        scope_shared_kernel_cache scope_cache(cache.get());
+        // declared after `cache`, so the tasks are done before it is destroyed
+        check_tasks tasks;
+        for (unsigned i : order) {
+            check_node & node = m_nodes[i];
+            declaration_kind k = node.m_decl.kind();
+            if (k == declaration_kind::Inductive || k == declaration_kind::Quot || k == declaration_kind::MutualDefinition) {
+                // these declarations are cheap to check and are needed to add the declarations that depend on them
+                auto node_start = std::chrono::steady_clock::now();
+                try {
+                    env = env.add(node.m_decl, true);
+                } catch (throwable &) {
+                    node.m_error = kernel_error_message();
+                    std::cerr << "error: failed to add '" << node.m_names[0] << "': " << node.m_error << std::endl;
+                    return 1;
+                }
+                node.m_time = std::chrono::steady_clock::now() - node_start;
+                if (k == declaration_kind::Inductive)
+                    check_generated(env, i);
+            } else {
+                object * c = lean_alloc_closure((void*)check_node_fn, 4, 3);
+                lean_closure_set(c, 0, env.to_obj_arg());
+                lean_closure_set(c, 1, box_size_t(reinterpret_cast<size_t>(&node)));
+                lean_closure_set(c, 2, box_size_t(reinterpret_cast<size_t>(cache.get())));
+                tasks.push_back(lean_task_spawn_core(c, 0, /* keep_alive */ false));
+                env = env.add(node.m_decl, false);
+            }
+        }
+        tasks.wait();
+        second_duration total_time = std::chrono::steady_clock::now() - start;
+
+        unsigned num_errors = 0;
+        second_duration kernel_time{0};
+        std::vector<unsigned> by_time;
+        for (unsigned i : order) {
+            check_node const & node = m_nodes[i];
+            kernel_time += node.m_time;
+            by_time.push_back(i);
+            if (!node.m_error.empty()) {
+                num_errors++;
+                std::cerr << "error: '" << node.m_names[0] << "': " << node.m_error << std::endl;
+            }
+        }
+        std::sort(by_time.begin(), by_time.end(), [&](unsigned i, unsigned j) { return m_nodes[i].m_time > m_nodes[j].m_time; });
+        if (report_fn) {
+            std::ofstream report(*report_fn);
+            if (!report)
+                throw exception(sstream() << "failed to open '" << *report_fn << "'");
+            for (unsigned i : by_time)
+                report << m_nodes[i].m_time.count() << "\t" << m_nodes[i].m_names[0] << "\n";
+        }
+        out << "checked " << m_nodes.size() << " declarations (" << m_node_of.size() << " constants) in "
+            << total_time.count() << "s, kernel time " << kernel_time.count() << "s, dependency analysis "
+            << prepare_time.count() << "s\n";
+        out << "slowest declarations:\n";
+        for (unsigned k = 0; k < std::min<size_t>(10, by_time.size()); k++)
+            out << "  " << m_nodes[by_time[k]].m_time.count() << "s " << m_nodes[by_time[k]].m_names[0] << "\n";
+        if (cache) {
+            char const * kind_names[shared_kernel_cache::num_kinds] = {"whnf", "whnf_core", "infer", "check"};
+            out << "shared cache:\n";
+            for (unsigned k = 0; k < shared_kernel_cache::num_kinds; k++) {
+                shared_kernel_cache::stats st = cache->get_stats(static_cast<shared_kernel_cache::kind>(k));
+                out << "  " << kind_names[k] << ": " << st.m_hits << " hits, " << st.m_misses << " misses, "
+                    << st.m_evictions << " evictions\n";
+            }
+        }
+        out << "replace cache: " << get_replace_cache_stats() << "\n";
+        out << "for_each cache: " << get_for_each_cache_stats() << "\n";
+        return num_errors;
+    }
+};
+}
+
+static void display_checker_help(std::ostream & out) {
+    out << "Lean (version " << get_version_string() << ")\n";
+    out << "Usage: leanchecker [options] Module...\n";
+    out << "Type checks again all declarations of the .olean files of the given modules and their imports\n";
+    out << "  --help -h          display this message\n";
+    out << "  --threads=num -j   number of threads used to check declarations\n";
+    out << "  --report=file -r   write the kernel time of each declaration to the given file\n";
+    out << "  --cache=num -c     share up to num whnf and type inference results of each kind between declarations\n";
+}
+
+static struct option g_checker_long_options[] = {
+    {"help",    no_argument,       0, 'h'},
+    {"threads", required_argument, 0, 'j'},
+    {"report",  required_argument, 0, 'r'},
+    {"cache",   required_argument, 0, 'c'},
+    {0, 0, 0, 0}
+};
+}
+
+using namespace lean; // NOLINT
+
+extern "C" LEAN_EXPORT int lean_checker_main(int argc, char ** argv) {
+    lean::initializer init;
+    unsigned num_threads = 0;
+#if defined(LEAN_MULTI_THREAD)
+    num_threads = hardware_concurrency();
+#endif
+    optional<std::string> report_fn;
+    size_t cache_capacity = 0;
+    while (true) {
+        int c = getopt_long(argc, argv, "hj:r:c:", g_checker_long_options, NULL);
+        if (c == -1)
+            break;
+        switch (c) {
+        case 'j':
+            num_threads = static_cast<unsigned>(atoi(optarg));
+            break;
+        case 'r':
+            report_fn = optarg;
+            break;
+        case 'c':
+            cache_capacity = static_cast<size_t>(atol(optarg));
+            break;
+        case 'h':
+            display_checker_help(std::cout);
+            return 0;
+        default:
+            display_checker_help(std::cerr);
+            return 1;
+        }
+    }
+    if (optind >= argc) {
+        display_checker_help(std::cerr);
+        return 1;
+    }
+    try {
+        get_io_scalar_result<unsigned>(lean_init_search_path(io_mk_world()));
+        scoped_task_manager scope_task_man(num_threads);
+        buffer<object_ref> imports;
+        for (int i = optind; i < argc; i++) {
+            // structure Import where module : Name, runtimeOnly : Bool := false
+            object * imp = alloc_cnstr(0, 1, 1);
+            cnstr_set(imp, 0, string_to_name(argv[i]).steal());
+            cnstr_set_uint8(imp, sizeof(object *), 0);
+            imports.push_back(object_ref(imp));
+        }
+        environment env = get_io_result<environment>(
+            lean_import_modules(to_list_ref(imports).steal(), options().to_obj_arg(), 0, io_mk_world()));
+        unsigned num_errors = checker(env).replay(std::cout, report_fn, cache_capacity);
+        if (num_errors > 0) {
+            std::cerr << num_errors << " declaration(s) failed to check" << std::endl;
+            return 1;
+        }
+        return 0;
+    } catch (throwable & ex) {
+        std::cerr << "error: " << ex.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,134 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "util/lz4.h"
+
+namespace lean {
+// minimal match length of the format
+static constexpr size_t min_match     = 4;
+// the last match must start at least 12 bytes before the end of the block
+static constexpr size_t match_limit   = 12;
+// the last 5 bytes of the block are always literals
+static constexpr size_t last_literals = 5;
+static constexpr size_t max_offset    = 65535;
+static constexpr unsigned hash_log    = 12;
+
+static inline uint32_t read32(char const * p) {
+    uint32_t r;
+    memcpy(&r, p, sizeof(r));
+    return r;
+}
+
+static inline uint32_t hash4(char const * p) {
+    return (read32(p) * 2654435761u) >> (32 - hash_log);
+}
+
+static inline char * write_length(char * op, size_t len) {
+    while (len >= 255) {
+        *op++ = static_cast<char>(255);
+        len -= 255;
+    }
+    *op++ = static_cast<char>(len);
+    return op;
+}
+
+static char * write_sequence(char * op, char const * lit, size_t lit_len, size_t offset, size_t match_len) {
+    char * token = op++;
+    unsigned t = static_cast<unsigned>(lit_len >= 15 ? 15 : lit_len) << 4;
+    if (lit_len >= 15)
+        op = write_length(op, lit_len - 15);
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len > 0) {
+        *op++ = static_cast<char>(offset & 0xff);
+        *op++ = static_cast<char>(offset >> 8);
+        size_t ml = match_len - min_match;
+        t |= ml >= 15 ? 15 : static_cast<unsigned>(ml);
+        if (ml >= 15)
+            op = write_length(op, ml - 15);
+    }
+    *token = static_cast<char>(t);
+    return op;
+}
+
+size_t lz4_compress(char const * src, size_t sz, char * dst) {
+    char * op = dst;
+    char const * anchor = src;
+    if (sz > match_limit) {
+        std::vector<uint32_t> table(static_cast<size_t>(1) << hash_log, 0);
+        char const * ip    = src + 1;
+        char const * limit = src + sz - match_limit;
+        char const * end   = src + sz - last_literals;
+        while (ip < limit) {
+            uint32_t h       = hash4(ip);
+            char const * ref = src + table[h];
+            table[h] = static_cast<uint32_t>(ip - src);
+            if (ref < ip && static_cast<size_t>(ip - ref) <= max_offset && read32(ref) == read32(ip)) {
+                size_t len = min_match;
+                while (ip + len < end && ip[len] == ref[len])
+                    len++;
+                op     = write_sequence(op, anchor, ip - anchor, ip - ref, len);
+                ip    += len;
+                anchor = ip;
+            } else {
+                ip++;
+            }
+        }
+    }
+    return write_sequence(op, anchor, src + sz - anchor, 0, 0) - dst;
+}
+
+static inline bool read_length(char const * & ip, char const * end, size_t & len) {
+    unsigned char b;
+    do {
+        if (ip >= end) return false;
+        b    = static_cast<unsigned char>(*ip++);
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool lz4_decompress(char const * src, size_t sz, char * dst, size_t dst_sz) {
+    char const * ip   = src;
+    char const * iend = src + sz;
+    char * op         = dst;
+    char * oend       = dst + dst_sz;
+    while (ip < iend) {
+        unsigned token = static_cast<unsigned char>(*ip++);
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && !read_length(ip, iend, lit_len))
+            return false;
+        if (lit_len > static_cast<size_t>(iend - ip) || lit_len > static_cast<size_t>(oend - op))
+            return false;
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend)
+            break; // last sequence
+        if (iend - ip < 2)
+            return false;
+        size_t offset = static_cast<unsigned char>(ip[0]) | (static_cast<size_t>(static_cast<unsigned char>(ip[1])) << 8);
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_length(ip, iend, match_len))
+            return false;
+        match_len += min_match;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst) || match_len > static_cast<size_t>(oend - op))
+            return false;
+        char const * ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            // overlapping match, repeats the last `offset` bytes
+            for (size_t i = 0; i < match_len; i++)
+                *op++ = *ref++;
+        }
+    }
+    return op == oend;
+}
+}
@@ -0,0 +1,22 @@
+/*
+Copyright (c) 2026 Microsoft Corporation. All rights reserved.
+Released under Apache 2.0 license as described in the file LICENSE.
+*/
+#pragma once
+#include <cstddef>
+
+namespace lean {
+/* Compression of independent blocks in the LZ4 block format, see
+   https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md */
+
+/** \brief Maximal size of the compressed data of a block of `sz` bytes. */
+inline size_t lz4_compress_bound(size_t sz) { return sz + sz / 255 + 16; }
+
+/** \brief Compress `[src, src + sz)` into `dst`, which must have room for `lz4_compress_bound(sz)` bytes.
+    Return the size of the compressed data. */
+size_t lz4_compress(char const * src, size_t sz, char * dst);
+
+/** \brief Decompress `[src, src + sz)` into `[dst, dst + dst_sz)`. Return `false` if the data is corrupted or
+    does not decompress to exactly `dst_sz` bytes. */
+bool lz4_decompress(char const * src, size_t sz, char * dst, size_t dst_sz);
+}
@@ -29,6 +29,8 @@ Author: Leonardo de Moura
 #include "util/option_declarations.h"
 #include "kernel/environment.h"
 #include "kernel/kernel_exception.h"
+#include "kernel/replace_fn.h"
+#include "kernel/for_each_fn.h"
 #include "library/formatter.h"
 #include "library/module.h"
 #include "library/time_task.h"
@@ -206,7 +208,7 @@ static void display_help(std::ostream & out) {
     std::cout << "  --trust=num -t     trust level (default: max) 0 means do not trust any macro,\n"
               << "                     and type check all imported modules\n";
     std::cout << "  --quiet -q         do not print verbose messages\n";
-    std::cout << "  --memory=num -M    maximum amount of memory that should be used by Lean\n";
+    std::cout << "  --memory=num -M    maximum amount of memory that should be used by Lean objects\n";
     std::cout << "                     (in megabytes)\n";
     std::cout << "  --timeout=num -T   maximum number of memory allocations per task\n";
     std::cout << "                     this is a deterministic way of interrupting long running tasks\n";
@@ -222,7 +224,7 @@ static void display_help(std::ostream & out) {
     std::cout << "  --print-prefix     print the installation prefix for Lean and exit\n";
     std::cout << "  --print-libdir     print the installation directory for Lean's built-in libraries and exit\n";
     std::cout << "  --profile          display elaboration/type checking time for each definition/theorem\n";
-    std::cout << "  --stats            display environment statistics\n";
+    std::cout << "  --stats            display environment and expression cache statistics\n";
     DEBUG_CODE(
     std::cout << "  --debug=tag        enable assertions with the given tag\n";
         )
@@ -729,6 +731,8 @@ extern "C" LEAN_EXPORT int lean_main(int argc, char ** argv) {
 
         if (stats) {
             env.display_stats();
+            std::cout << "replace cache: " << get_replace_cache_stats() << "\n";
+            std::cout << "for_each cache: " << get_for_each_cache_stats() << "\n";
         }
 
         if (run && ok) {
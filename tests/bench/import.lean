@@ -0,0 +1,53 @@
+import Lean
+open Lean
+
+/-!
+Imports a set of modules repeatedly and reports percentiles of the time spent in each phase of `importModules`,
+see `Lean.ImportStats`.
+
+Usage: `lean --run import.lean <runs> [--parallel] <module>...`, e.g. `lean --run import.lean 20 Lean`. With
+`--parallel`, the modules are imported with `importParallel`.
+-/
+
+def fmtMs (ns : Nat) : String :=
+  let us := ns / 1000
+  let frac := toString (us % 1000 + 1000) |>.drop 1
+  s!"{us / 1000}.{frac}ms"
+
+def percentiles (xs : Array Nat) : String :=
+  let xs := xs.qsort (· < ·)
+  let pct (p : Nat) := fmtMs xs[min (xs.size - 1) (p * xs.size / 100)]!
+  s!"p50 {pct 50}  p90 {pct 90}  p99 {pct 99}  max {fmtMs xs.back}"
+
+def report (name : String) (xs : Array Nat) : IO Unit :=
+  IO.println s!"{name.pushn ' ' (24 - name.length)}{percentiles xs}"
+
+unsafe def main (args : List String) : IO Unit := do
+  let (n :: args) := args
+    | throw <| IO.userError "usage: import.lean <runs> [--parallel] <module>..."
+  let (parallel, mods) := match args with
+    | "--parallel" :: mods => (true, mods)
+    | mods                 => (false, mods)
+  if mods.isEmpty then
+    throw <| IO.userError "usage: import.lean <runs> [--parallel] <module>..."
+  let imports := mods.map fun m => { module := m.toName : Import }
+  let opts := importParallel.set {} parallel
+  initSearchPath (← findSysroot)
+  let mut runs : Array ImportStats := #[]
+  for _ in [:n.toNat!] do
+    runs := runs.push (← withImportModules imports opts 0 fun _ => importStatsRef.get)
+  let last := runs.back
+  IO.println s!"{runs.size} runs, {last.modules.size} modules, {last.modules.filter (·.isMemoryMapped) |>.size} mmapped, {last.relocatedBytes} bytes relocated"
+  report "total" (runs.map (·.totalNanos))
+  report "reading modules" (runs.map (·.readNanos))
+  report "  opening files" (runs.map fun s => s.modules.foldl (· + ·.openNanos) 0)
+  report "  reading files" (runs.map fun s => s.modules.foldl (· + ·.readNanos) 0)
+  report "constant tables" (runs.map (·.constantTablesNanos))
+  report "imported entries" (runs.map (·.setImportedEntriesNanos))
+  report "finalize extensions" (runs.map (·.finalizeNanos))
+  -- extensions are always finalized in the same order
+  let exts := last.extensions.mapIdx fun i e => (e.name, runs.map fun s => (s.extensions.getD i.val e).addImportedNanos)
+  let slowest := exts.qsort (fun a b => a.2.foldl (· + ·) 0 > b.2.foldl (· + ·) 0)
+  IO.println "slowest `addImportedFn`s:"
+  for (name, xs) in slowest[:10] do
+    report s!"  {name}" xs
@@ -0,0 +1,47 @@
+import Lean
+open Lean
+
+/-!
+Writes the imported modules back to .olean files repeatedly and reports percentiles of the write time and the write
+throughput, see `saveModuleData`.
+
+Usage: `lean --run olean_write.lean <runs> <module>...`, e.g. `lean --run olean_write.lean 5 Lean`
+-/
+
+def fmtMs (ns : Nat) : String :=
+  let us := ns / 1000
+  let frac := toString (us % 1000 + 1000) |>.drop 1
+  s!"{us / 1000}.{frac}ms"
+
+def fmtMBs (x : Nat) : String :=
+  s!"{x}MB/s"
+
+def percentiles (xs : Array Nat) (fmt : Nat → String) : String :=
+  let xs := xs.qsort (· < ·)
+  let pct (p : Nat) := fmt xs[min (xs.size - 1) (p * xs.size / 100)]!
+  s!"p50 {pct 50}  p90 {pct 90}  max {fmt xs.back}"
+
+unsafe def main (args : List String) : IO Unit := do
+  let (n :: mods@(_ :: _)) := args
+    | throw <| IO.userError "usage: olean_write.lean <runs> <module>..."
+  let imports := mods.map fun m => { module := m.toName : Import }
+  initSearchPath (← findSysroot)
+  let dir : System.FilePath := "olean_write.tmp"
+  IO.FS.createDirAll dir
+  withImportModules imports {} 0 fun env => do
+    let mut times := #[]
+    let mut bytes := 0
+    for _ in [:n.toNat!] do
+      bytes := 0
+      let start ← IO.monoNanosNow
+      for mod in env.header.moduleNames, data in env.header.moduleData do
+        let fname := dir / s!"{mod}.olean"
+        saveModuleData fname mod data
+        bytes := bytes + (← fname.metadata).byteSize.toNat
+      times := times.push ((← IO.monoNanosNow) - start)
+    IO.println s!"{times.size} runs, {env.header.moduleNames.size} modules, {bytes} bytes"
+    IO.println s!"write time  {percentiles times fmtMs}"
+    -- in MB/s, slower runs have a lower throughput
+    let throughput := times.map fun t => bytes * 1000 / max t 1
+    IO.println s!"throughput  {percentiles throughput fmtMBs}"
+  IO.FS.removeDirAll dir
@@ -0,0 +1,25 @@
+/-!
+Tasks that repeatedly take and drop references to the elements of a shared array, which mostly exercises the
+atomic reference counters of multi-threaded objects. Compare runs with and without `LEAN_DEFERRED_RC`.
+-/
+
+def mkShared (n : Nat) : Array (List Nat) :=
+  ((List.range n).map fun i => List.replicate (i % 8) i).toArray
+
+-- The pairs hold new references to the shared elements, which are dropped together with the result.
+@[noinline] def pairUp (xs : Array (List Nat)) : Array (List Nat × List Nat) :=
+  xs.map fun x => (x, x)
+
+def work (xs : Array (List Nat)) (iters seed : Nat) : Nat := Id.run do
+  let mut s := seed
+  for _ in [0:iters] do
+    s := s + (pairUp xs).size
+  return s
+
+def main : List String → IO UInt32
+  | [tasks, iters] => do
+    let xs := mkShared 10000
+    let ts := (List.range tasks.toNat!).map fun i => Task.spawn fun _ => work xs iters.toNat! i
+    IO.println (ts.foldl (fun s t => s + t.get) 0)
+    return 0
+  | _ => return 1
@@ -0,0 +1,16 @@
+import Lean
+open Lean
+
+set_option kernel.asyncTheorems true
+
+theorem foo : 1 + 1 = 2 := rfl
+theorem bar : 2 = 1 + 1 := foo.symm
+
+#eval show CoreM Unit from do
+  assert! !(← (← getEnv).waitKernelChecks (← getOptions)).hasErrors
+  -- the theorem is added before its value is checked, the failure is only reported when waiting for the check
+  let env ← getEnv
+  addDecl <| .thmDecl { name := `bad, levelParams := [], type := mkConst ``True, value := mkConst ``False }
+  assert! (← getEnv).contains `bad
+  assert! (← (← getEnv).waitKernelChecks (← getOptions)).hasErrors
+  setEnv env
@@ -0,0 +1,12 @@
+import Lean
+open Lean
+
+#eval id (α := IO _) do
+  let imports := [{ module := `Init.Data.List.Basic }]
+  let env₁ ← importModules imports (importLazy.set {} true)
+  let env₂ ← importModules imports {}
+  for (c, _) in env₂.constants.toList do
+    assert! (env₁.find? c).map (·.name) == some c
+    assert! env₁.getModuleIdxFor? c == env₂.getModuleIdxFor? c
+  assert! !env₁.contains `Lean.Elab.Command.elabCommand
+  assert! env₁.find? `List.map |>.isSome
@@ -0,0 +1,13 @@
+import Lean
+open Lean
+
+#eval id (α := IO _) do
+  let imports := [{ module := `Init.Data.List.Basic }]
+  let env₁ ← importModules imports (importParallel.set {} true)
+  let env₂ ← importModules imports (importParallel.set {} false)
+  assert! env₁.header.moduleNames == env₂.header.moduleNames
+  assert! env₁.header.moduleData.map (·.constNames) == env₂.header.moduleData.map (·.constNames)
+  assert! env₁.constants.toList.length == env₂.constants.toList.length
+  for (c, info) in env₂.constants.toList do
+    assert! (env₁.find? c).map (·.name) == some info.name
+    assert! env₁.getModuleIdxFor? c == env₂.getModuleIdxFor? c
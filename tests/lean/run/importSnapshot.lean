@@ -0,0 +1,25 @@
+import Lean
+open Lean
+
+#eval id (α := IO _) do
+  let dir : System.FilePath := "importSnapshot.tmp"
+  if ← dir.pathExists then
+    IO.FS.removeDirAll dir
+  let imports := [{ module := `Init.Data.List.Basic }]
+  let opts := importSnapshotDir.set {} dir.toString
+  let env₁ ← importModules imports opts
+  let env₂ ← importModules imports opts
+  let env₃ ← importModules imports {}
+  -- snapshots are only used if changes of all imported files can be detected, which is not the case for files
+  -- written by stage0
+  let hashed ← env₂.header.moduleNames.allM fun m => return (← readOleanHeader (← findOLean m)).any (·.importsHash != 0)
+  assert! (env₂.header.regions.size == env₂.header.moduleNames.size + 1) == hashed
+  if hashed then
+    -- the snapshot refers to the constants of the modules instead of copying them
+    let snapshotBytes ← (← dir.readDir).foldlM (init := 0) fun n e => return n + (← e.path.metadata).byteSize.toNat
+    let oleanBytes := (← importStatsRef.get).modules.foldl (· + ·.byteSize) 0
+    assert! snapshotBytes * 2 < oleanBytes
+  for (c, _) in env₃.constants.toList do
+    assert! (env₂.find? c).map (·.name) == some c
+    assert! env₂.getModuleIdxFor? c == env₁.getModuleIdxFor? c
+  IO.FS.removeDirAll dir
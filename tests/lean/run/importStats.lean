@@ -0,0 +1,17 @@
+import Lean
+open Lean
+
+#eval id (α := IO _) do
+  let env ← importModules [{ module := `Init.Data.List.Basic }] {}
+  let stats ← importStatsRef.get
+  assert! stats.modules.map (·.module) == env.header.moduleNames
+  assert! stats.modules.all (·.byteSize > 0)
+  -- only the modules that could not be memory-mapped are relocated
+  assert! stats.relocatedBytes == (stats.modules.filter (!·.isMemoryMapped)).foldl (· + ·.byteSize) 0
+  assert! stats.modules.all (·.isMemoryMapped) == (stats.relocatedBytes == 0)
+  assert! stats.extensions.size == (← persistentEnvExtensionsRef.get).size
+  -- `Init` declares namespaces, such as `List`
+  let some namespaces := stats.extensions.find? (·.name == ``namespacesExt)
+    | throw <| IO.userError "no statistics for `namespacesExt`"
+  assert! namespaces.numEntries > 0
+  assert! stats.readNanos ≤ stats.totalNanos
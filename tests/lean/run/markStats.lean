@@ -0,0 +1,12 @@
+#eval id (α := IO _) do
+  let s₁ ← IO.getMarkStats
+  -- depend on a runtime value so that the array is not a closed term, which would be persistent already
+  let k ← IO.monoNanosNow
+  let xs := (Array.range 200000).map fun i => [i + k % 2]
+  -- capturing `xs` marks the array and its 200000 lists, more than the threshold of parallel marking
+  let t := Task.spawn fun _ => xs.foldl (fun n l => n + l.length) 0
+  assert! t.get == 200000
+  let s₂ ← IO.getMarkStats
+  assert! s₂.numMtCalls > s₁.numMtCalls
+  assert! s₂.maxMtMarked ≥ 200000
+  assert! s₂.numMtParallel > s₁.numMtParallel
@@ -0,0 +1,9 @@
+import Lean
+open Lean
+
+#eval id (α := IO _) do
+  let fname : System.FilePath := "oleanDictionary.tmp"
+  let env ← importModules [{ module := `Init.Prelude }] {}
+  writeOleanDictionary env fname
+  assert! (← fname.metadata).byteSize > 0
+  IO.FS.removeFile fname
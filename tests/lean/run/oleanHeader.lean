@@ -0,0 +1,23 @@
+import Lean
+open Lean
+
+#eval id (α := IO _) do
+  let fname : System.FilePath := "oleanHeader.tmp"
+  let env ← importModules [{ module := `Init.Prelude }] {}
+  saveModuleData fname `oleanHeader (← mkModuleData env) (← mkImportsHash env.header.imports)
+  let some header' ← readOleanHeader fname
+    | throw <| IO.userError "header expected"
+  assert! header'.githash == Lean.githash
+  -- the content hash only depends on the module data
+  saveModuleData fname `oleanHeader (← mkModuleData env)
+  assert! (← readOleanHeader fname).map (·.contentHash) == some header'.contentHash
+  -- a file written by another version is rejected, the git hash follows the header, base address and dictionary
+  let bytes ← IO.FS.readBinFile fname
+  IO.FS.writeBinFile fname (bytes.set! 48 'x'.toNat.toUInt8)
+  match (← (readModuleData fname).toBaseIO) with
+  | .ok _ => throw <| IO.userError "file of another version was read"
+  | .error e => assert! ((toString e).splitOn "different Lean version").length > 1
+  -- files in the format written by stage0 have no header
+  IO.FS.writeBinFile fname ("oleanfile!!!!!!!".toUTF8 ++ ⟨mkArray 8 0⟩)
+  assert! (← readOleanHeader fname).isNone
+  IO.FS.removeFile fname
@@ -0,0 +1,13 @@
+#eval id (α := IO _) do
+  let s₀ ← IO.getTaskStats
+  let ts := (List.range 10).map fun i => Task.spawn fun _ => i
+  let r ← IO.wait (Task.mapList (fun xs => xs.foldl (· + ·) 0) ts)
+  assert! r == 45
+  let s ← IO.getTaskStats
+  -- all counters are zero without a task manager
+  if s.numWorkers > 0 then
+    -- the ten tasks and the `mapList` task were queued and run before `r` became available
+    assert! s.numEnqueued ≥ s₀.numEnqueued + 11
+    assert! s.numExecuted ≥ s₀.numExecuted + 11
+    assert! s.maxQueueDepth ≥ max s₀.maxQueueDepth 1
+    assert! s.maxQueueDepth < 2^31
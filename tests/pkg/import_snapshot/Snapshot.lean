@@ -0,0 +1,14 @@
+import Lean
+open Lean
+
+/--
+Import `A` with the import snapshots of the given directory. Print whether a snapshot was used, and whether each
+constant of `A` is found under its own name.
+-/
+def main (args : List String) : IO Unit := do
+  initSearchPath (← findSysroot)
+  let env ← importModules [{ module := `A }] (importSnapshotDir.set {} args[0]!)
+  let usedSnapshot := env.header.regions.size == env.header.moduleNames.size + 1
+  let mod := env.header.moduleData[0]!
+  let found := mod.constNames.all fun c => (env.find? c).map (·.name) == some c
+  IO.println s!"snapshot: {usedSnapshot}, found: {found}, constants: {mod.constNames.size}"
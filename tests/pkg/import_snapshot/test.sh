@@ -0,0 +1,13 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+rm -rf build
+mkdir -p build/olean
+lean --root=v1 -o build/olean/A.olean v1/A.lean
+LEAN_PATH=build/olean lean --run Snapshot.lean build/snapshots | grep -F 'snapshot: false, found: true, constants: 2'
+LEAN_PATH=build/olean lean --run Snapshot.lean build/snapshots | grep -F 'snapshot: true, found: true, constants: 2'
+
+# the snapshot of the old `A` is rejected, the positions of its constants have changed
+lean --root=v2 -o build/olean/A.olean v2/A.lean
+LEAN_PATH=build/olean lean --run Snapshot.lean build/snapshots | grep -F 'snapshot: false, found: true, constants: 3'
+LEAN_PATH=build/olean lean --run Snapshot.lean build/snapshots | grep -F 'snapshot: true, found: true, constants: 3'
@@ -0,0 +1,3 @@
+prelude
+axiom a : Prop
+axiom b : Prop
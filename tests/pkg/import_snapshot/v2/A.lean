@@ -0,0 +1,4 @@
+prelude
+axiom c : Prop
+axiom b : Prop
+axiom a : Prop
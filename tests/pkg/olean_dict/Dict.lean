@@ -0,0 +1,7 @@
+def sumTo : Nat → Nat
+  | 0     => 0
+  | n + 1 => n + 1 + sumTo n
+
+theorem sumTo_succ (n : Nat) : sumTo (n + 1) = n + 1 + sumTo n := rfl
+
+def names : List String := ["List", "Nat", "String"].map (·.push '!')
@@ -0,0 +1,5 @@
+import Dict
+
+example : sumTo 3 = 6 := rfl
+example (n : Nat) : sumTo (n + 1) = n + 1 + sumTo n := sumTo_succ n
+#eval names
@@ -0,0 +1,8 @@
+import Lean
+open Lean
+
+/-- Write the .olean dictionary of the objects of `Init` to the given file. -/
+def main (args : List String) : IO Unit := do
+  initSearchPath (← findSysroot)
+  let env ← importModules [{ module := `Init }] {}
+  writeOleanDictionary env args[0]!
@@ -0,0 +1,21 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+rm -rf build
+mkdir -p build/plain build/dict
+lean --run WriteDict.lean build/init.dict
+lean --root=. -o build/plain/Dict.olean Dict.lean
+LEAN_OLEAN_DICTIONARY=build/init.dict lean --root=. -o build/dict/Dict.olean Dict.lean
+
+# objects shared with `Init` are referenced instead of copied
+plain=$(wc -c < build/plain/Dict.olean)
+dict=$(wc -c < build/dict/Dict.olean)
+echo "Dict.olean: $plain bytes, $dict bytes with the dictionary"
+[ "$dict" -lt "$plain" ]
+
+# the module can be read back with the dictionary, and only with it
+LEAN_OLEAN_DICTIONARY=build/init.dict LEAN_PATH=build/dict lean UseDict.lean | grep -F '["List!", "Nat!", "String!"]'
+if LEAN_PATH=build/dict lean UseDict.lean 2>&1; then
+  echo "reading Dict.olean without its dictionary succeeded"
+  exit 1
+fi